@@ -0,0 +1,86 @@
+#include "distance-transform.h"
+
+#include <limits>
+
+using std::vector;
+
+static const int64_t NO_FEATURE = std::numeric_limits<int64_t>::max();
+
+void distanceTransformFill(Image &image) {
+    const int width = image.width, height = image.height;
+
+    // Column pass: row of the nearest non-zero pixel in the same column, -1 if the column has none.
+    // The downward sweep finds the nearest one above, the upward sweep replaces it only if strictly closer.
+    vector<int> feature_row(width * height, -1);
+    for (int x = 0; x < width; x++) {
+        int last = -1;
+        for (int y = 0; y < height; y++) {
+            if (image.pixels[y * width + x]) {
+                last = y;
+            }
+            feature_row[y * width + x] = last;
+        }
+        last = -1;
+        for (int y = height - 1; y >= 0; y--) {
+            if (image.pixels[y * width + x]) {
+                last = y;
+            }
+            int &row = feature_row[y * width + x];
+            if (last >= 0 && (row < 0 || last - y < y - row)) {
+                row = last;
+            }
+        }
+    }
+
+    // Row pass: lower envelope of the parabolas (x - q)^2 + f(q), f(q) being the squared column
+    // distance, following Felzenszwalb and Huttenlocher, "Distance Transforms of Sampled Functions"
+    vector<int64_t> f(width);
+    vector<int> v(width);
+    vector<double> z(width + 1);
+    for (int y = 0; y < height; y++) {
+        for (int q = 0; q < width; q++) {
+            const int row = feature_row[y * width + q];
+            f[q] = row < 0 ? NO_FEATURE : (int64_t) (row - y) * (row - y);
+        }
+
+        int k = -1;
+        for (int q = 0; q < width; q++) {
+            if (f[q] == NO_FEATURE) {
+                continue;
+            }
+            if (k < 0) {
+                k = 0;
+                v[0] = q;
+                z[0] = -std::numeric_limits<double>::infinity();
+                z[1] = std::numeric_limits<double>::infinity();
+                continue;
+            }
+            double s = ((f[q] + (int64_t) q * q) - (f[v[k]] + (int64_t) v[k] * v[k])) / (2.0 * (q - v[k]));
+            while (s <= z[k]) {
+                // The parabola of v[k] is nowhere the lowest any more
+                k--;
+                s = ((f[q] + (int64_t) q * q) - (f[v[k]] + (int64_t) v[k] * v[k])) / (2.0 * (q - v[k]));
+            }
+            k++;
+            v[k] = q;
+            z[k] = s;
+            z[k + 1] = std::numeric_limits<double>::infinity();
+        }
+        if (k < 0) {
+            // No column has a non-zero pixel, so neither does the image
+            return;
+        }
+
+        // At an exact intersection the parabola found first, i.e. the leftmost column, is kept
+        int j = 0;
+        for (int x = 0; x < width; x++) {
+            while (z[j + 1] < x) {
+                j++;
+            }
+            if (!image.pixels[y * width + x]) {
+                const int q = v[j];
+                image.pixels[y * width + x] = image.pixels[feature_row[y * width + q] * width + q];
+            }
+        }
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef C_IMPL_DISTANCE_TRANSFORM_H
+#define C_IMPL_DISTANCE_TRANSFORM_H
+
+#include "image.h"
+
+/* Occlusion fill based on the exact Euclidean distance transform of Felzenszwalb and Huttenlocher.
+ * Every zero pixel takes the value of its nearest non-zero pixel in O(width * height) total, however
+ * large the holes are. Distances are exact, so the result equals the ring search of crossCheckFill()
+ * except where several non-zero pixels are equally near: this transform then takes the one in the
+ * leftmost column, and the upper one within a column, whereas the ring search takes the first one in
+ * its scan order. The image is filled in place, as only zero pixels are written and only non-zero
+ * ones are read. An image without any non-zero pixel is left unchanged.
+ */
+void distanceTransformFill(Image &image);
+
+#endif //C_IMPL_DISTANCE_TRANSFORM_H
@@ -0,0 +1,125 @@
+#include "fixed-zncc.h"
+
+#include <stdlib.h>
+#include <algorithm>
+
+using std::max;
+using std::min;
+using std::vector;
+
+/* Per-pixel window statistics of an image in int32, for windows that fit inside it */
+struct FixedStats {
+    vector<int32_t> mean;
+    vector<int32_t> sum;
+    vector<int32_t> deviation;
+};
+
+static FixedStats fixed_stats(const Image &image, const WindowBounds &bounds) {
+    FixedStats stats;
+    const unsigned size = image.width * image.height;
+    stats.mean = vector<int32_t>(size, 0);
+    stats.sum = vector<int32_t>(size, 0);
+    stats.deviation = vector<int32_t>(size, 0);
+
+    for (int y = -bounds.minY; y < (int) image.height - bounds.maxY; y++) {
+        for (int x = -bounds.minX; x < (int) image.width - bounds.maxX; x++) {
+            WindowStats s = image.integral.windowStats(x + bounds.minX, y + bounds.minY,
+                                                       x + bounds.maxX, y + bounds.maxY);
+            stats.mean[y * image.width + x] = s.mean;
+            stats.sum[y * image.width + x] = s.sum;
+            stats.deviation[y * image.width + x] = (int32_t) s.deviation;
+        }
+    }
+    return stats;
+}
+
+/* Whether a * b > c * d, for a, c < 2^64 and b, d < 2^32, computed in 64-bit halves so it is exact
+ * on targets without a 128-bit integer type
+ */
+static bool product_greater(const uint64_t a, const uint32_t b, const uint64_t c, const uint32_t d) {
+    const uint64_t ab_low = (a & 0xFFFFFFFF) * b, cd_low = (c & 0xFFFFFFFF) * d;
+    const uint64_t ab_high = (a >> 32) * b + (ab_low >> 32), cd_high = (c >> 32) * d + (cd_low >> 32);
+    if (ab_high != cd_high) {
+        return ab_high > cd_high;
+    }
+    return (ab_low & 0xFFFFFFFF) > (cd_low & 0xFFFFFFFF);
+}
+
+Image fixed_point_algorithm(const Image &L_image, const Image &R_image, const int &min_disp,
+                            const int &max_disp, Window &window) {
+    const WindowBounds bounds = window.bounds();
+    const int width = L_image.width, height = L_image.height;
+    const int minX = bounds.minX, maxX = bounds.maxX, minY = bounds.minY, maxY = bounds.maxY;
+    const int32_t count = (maxX - minX + 1) * (maxY - minY + 1);
+
+    Image output;
+    output.width = L_image.width;
+    output.height = L_image.height;
+    output.pixels = vector<unsigned char>(width * height, 0);
+
+    FixedStats L_stats = fixed_stats(L_image, bounds);
+    FixedStats R_stats = fixed_stats(R_image, bounds);
+    // Numerator and right deviation of the best candidate so far, a zero numerator meaning none yet
+    vector<int32_t> best_upper(width * height, 0);
+    vector<int32_t> best_deviation(width * height, 0);
+    vector<int32_t> column_sums(width);
+
+    // Disparities are visited in the same order as in algorithm(), so ties resolve identically
+    for (int disp = min_disp; disp < max_disp; disp++) {
+        const int x_start = max(-minX, disp - minX);
+        const int x_end = min(width - maxX, (int) R_image.width - maxX + disp);
+        if (x_start >= x_end) {
+            continue;
+        }
+        const int column_start = x_start + minX, column_end = x_end + maxX;
+
+        for (int column = column_start; column < column_end; column++) {
+            int32_t sum = 0;
+            for (int row = 0; row <= maxY - minY; row++) {
+                sum += L_image.pixels[row * width + column] * R_image.pixels[row * R_image.width + column - disp];
+            }
+            column_sums[column] = sum;
+        }
+
+        for (int y = -minY; y < height - maxY; y++) {
+            if (y > -minY) {
+                const int removed = y + minY - 1, added = y + maxY;
+                for (int column = column_start; column < column_end; column++) {
+                    column_sums[column] +=
+                            L_image.pixels[added * width + column] * R_image.pixels[added * R_image.width + column - disp]
+                            - L_image.pixels[removed * width + column] * R_image.pixels[removed * R_image.width + column - disp];
+                }
+            }
+
+            int32_t cross_sum = 0;
+            for (int column = x_start + minX; column < x_start + maxX; column++) {
+                cross_sum += column_sums[column];
+            }
+            for (int x = x_start; x < x_end; x++) {
+                cross_sum += column_sums[x + maxX];
+                if (x > x_start) {
+                    cross_sum -= column_sums[x + minX - 1];
+                }
+
+                const int l = y * width + x, r = y * R_image.width + x - disp;
+                const int32_t L_mean = L_stats.mean[l], R_mean = R_stats.mean[r];
+                const int32_t upper_sum = cross_sum - L_mean * R_stats.sum[r] - R_mean * L_stats.sum[l]
+                                          + count * L_mean * R_mean;
+                const int32_t deviation = R_stats.deviation[r];
+                // Only positive correlations can beat the initial maximum of zero, and flat windows
+                // have an undefined ZNCC that algorithm() never selects either
+                if (upper_sum <= 0 || deviation == 0 || L_stats.deviation[l] == 0) {
+                    continue;
+                }
+                if (best_upper[l] == 0
+                    || product_greater((uint64_t) upper_sum * upper_sum, best_deviation[l],
+                                       (uint64_t) best_upper[l] * best_upper[l], deviation)) {
+                    best_upper[l] = upper_sum;
+                    best_deviation[l] = deviation;
+                    output.pixels[l] = abs(disp);
+                }
+            }
+        }
+    }
+    return output;
+}
@@ -0,0 +1,17 @@
+#ifndef C_IMPL_FIXED_ZNCC_H
+#define C_IMPL_FIXED_ZNCC_H
+
+#include "image.h"
+#include "window.h"
+
+/* Disparity engine that works entirely in integers. Window sums, squared sums and cross terms are
+ * accumulated exactly in int32 with sliding column sums, and candidates are compared without
+ * division or square roots: for ZNCC = U / sqrt(A * B) with A fixed per pixel, a candidate (U, B)
+ * beats the best so far (U0, B0) when U^2 * B0 > U0^2 * B. This is the exact form of the comparison
+ * algorithm() makes in floating point.
+ * The window must be a filled rectangle of at most 16512 pixels, so that no int32 term can overflow.
+ */
+Image fixed_point_algorithm(const Image &L_image, const Image &R_image, const int &min_disp,
+                            const int &max_disp, Window &window);
+
+#endif //C_IMPL_FIXED_ZNCC_H
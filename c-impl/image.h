@@ -0,0 +1,22 @@
+#ifndef C_IMPL_IMAGE_H
+#define C_IMPL_IMAGE_H
+
+#include <cstdint>
+#include <vector>
+#include "integral-image.h"
+
+struct Image {
+    unsigned int height, width;
+    std::vector<unsigned char> pixels;
+    // Window statistics tables, built by load_image() for images that are used as algorithm input
+    IntegralImage integral;
+
+    uint8_t getPixel(int x, int y) const {
+        if (x >= width || y >= height) {
+            return 0;
+        }
+        return pixels[y*width + x];
+    }
+};
+
+#endif //C_IMPL_IMAGE_H
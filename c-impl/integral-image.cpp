@@ -0,0 +1,51 @@
+#include "integral-image.h"
+
+using std::vector;
+
+IntegralImage build_integral_image(const vector<unsigned char> &pixels, const unsigned width, const unsigned height) {
+    IntegralImage integral;
+    integral.width = width;
+    integral.height = height;
+
+    const unsigned stride = width + 1;
+    integral.sum = vector<uint32_t>(stride * (height + 1), 0);
+    integral.squared_sum = vector<uint64_t>(stride * (height + 1), 0);
+
+    for (unsigned y = 0; y < height; y++) {
+        uint32_t row_sum = 0;
+        uint64_t row_squared_sum = 0;
+        for (unsigned x = 0; x < width; x++) {
+            const uint32_t p = pixels[y * width + x];
+            row_sum += p;
+            row_squared_sum += p * p;
+            integral.sum[(y + 1) * stride + x + 1] = integral.sum[y * stride + x + 1] + row_sum;
+            integral.squared_sum[(y + 1) * stride + x + 1] = integral.squared_sum[y * stride + x + 1] + row_squared_sum;
+        }
+    }
+    return integral;
+}
+
+/* Sum over the pixels x0..x1, y0..y1 (inclusive). The rectangle must lie inside the image. */
+uint32_t IntegralImage::rectSum(const int x0, const int y0, const int x1, const int y1) const {
+    const unsigned stride = width + 1;
+    return sum[(y1 + 1) * stride + x1 + 1] - sum[y0 * stride + x1 + 1]
+           - sum[(y1 + 1) * stride + x0] + sum[y0 * stride + x0];
+}
+
+uint64_t IntegralImage::rectSquaredSum(const int x0, const int y0, const int x1, const int y1) const {
+    const unsigned stride = width + 1;
+    return squared_sum[(y1 + 1) * stride + x1 + 1] - squared_sum[y0 * stride + x1 + 1]
+           - squared_sum[(y1 + 1) * stride + x0] + squared_sum[y0 * stride + x0];
+}
+
+WindowStats IntegralImage::windowStats(const int x0, const int y0, const int x1, const int y1) const {
+    WindowStats stats;
+    stats.count = (x1 - x0 + 1) * (y1 - y0 + 1);
+    stats.sum = rectSum(x0, y0, x1, y1);
+    stats.squared_sum = rectSquaredSum(x0, y0, x1, y1);
+    stats.mean = stats.sum / stats.count;
+    // sum((p - m)^2) = sum(p^2) - 2m * sum(p) + n * m^2, exact for the truncated mean as well
+    stats.deviation = (int64_t) stats.squared_sum - 2 * (int64_t) stats.mean * stats.sum
+                      + (int64_t) stats.count * stats.mean * stats.mean;
+    return stats;
+}
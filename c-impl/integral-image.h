@@ -0,0 +1,37 @@
+#ifndef C_IMPL_INTEGRAL_IMAGE_H
+#define C_IMPL_INTEGRAL_IMAGE_H
+
+#include <cstdint>
+#include <vector>
+
+/* Sum and squared sum of the pixels of a window, together with the window mean
+ * and the sum of squared deviations from that mean. The mean is truncated to an
+ * integer, matching calculate_mean_value().
+ */
+struct WindowStats {
+    uint32_t count;
+    uint32_t sum;
+    uint64_t squared_sum;
+    int mean;
+    int64_t deviation;
+};
+
+/* Summed-area tables of an 8-bit image, one for pixel values and one for squared pixel values.
+ * Entry (x, y) holds the sum of all pixels above and to the left of (x, y), exclusive, so the
+ * tables have one extra row and column and any rectangle sum takes four lookups.
+ */
+struct IntegralImage {
+    unsigned int width = 0, height = 0;
+    std::vector<uint32_t> sum;
+    std::vector<uint64_t> squared_sum;
+
+    uint32_t rectSum(int x0, int y0, int x1, int y1) const;
+
+    uint64_t rectSquaredSum(int x0, int y0, int x1, int y1) const;
+
+    WindowStats windowStats(int x0, int y0, int x1, int y1) const;
+};
+
+IntegralImage build_integral_image(const std::vector<unsigned char> &pixels, unsigned width, unsigned height);
+
+#endif //C_IMPL_INTEGRAL_IMAGE_H
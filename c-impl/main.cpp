@@ -1,112 +1,27 @@
 #include <iostream>
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
 #include "lodepng.h"
 #include <sys/time.h>
 #include "../lib/timing.h"
+#include "../lib/png-stream.h"
+#include "image.h"
+#include "window.h"
+#include "sliding-zncc.h"
+#include "simd-zncc.h"
+#include "parallel-zncc.h"
+#include "symmetric-zncc.h"
+#include "patch-cache.h"
+#include "fixed-zncc.h"
+#include "post-process.h"
+#include "preprocess.h"
+#include "thread-pool.h"
 
 using std::vector;
 using std::cout;
 using std::endl;
 
-struct Image {
-    unsigned int height, width;
-    vector<unsigned char> pixels;
-
-    uint8_t getPixel(int x, int y) const {
-        if (x >= width || y >= height) {
-            return 0;
-        }
-        return pixels[y*width + x];
-    }
-};
-
-struct Offset {
-    int x, y;
-};
-
-struct Window {
-    vector<Offset> offsets;
-    int minX=0, minY=0, maxX=0, maxY=0;
-
-    int minXOffset() {
-        if (minX != 0) return minX;
-        int min = INT8_MAX;
-        for (int i = 0; i < offsets.size(); i++) {
-            if (offsets[i].x < min) {
-                min = offsets[i].x;
-            }
-        }
-        minX = min;
-        return min;
-    }
-
-    int minYOffset() {
-        if (minY != 0) return minY;
-        int min = INT8_MAX;
-        for (int i = 0; i < offsets.size(); i++) {
-            if (offsets[i].y < min) {
-                min = offsets[i].y;
-            }
-        }
-        minY = min;
-        return min;
-    }
-
-    int maxXOffset() {
-        if (maxX != 0) return maxX;
-        int max = INT8_MIN;
-        for (int i = 0; i < offsets.size(); i++) {
-            if (offsets[i].x > max) {
-                max = offsets[i].x;
-            }
-        }
-        maxX = max;
-        return max;
-    }
-
-    int maxYOffset() {
-        if (maxY != 0) return maxY;
-        int max = INT8_MIN;
-        for (int i = 0; i < offsets.size(); i++) {
-            if (offsets[i].y > max) {
-                max = offsets[i].y;
-            }
-        }
-        maxY = max;
-        return max;
-    }
-
-    int width() const {
-        int minx = INT8_MAX;
-        int maxx = INT8_MIN;
-        for (int i = 0; i < offsets.size(); i++) {
-            int x = offsets[i].x;
-            if (x < minx) {
-                minx = x;
-            }
-            if (x > maxx) {
-                maxx = x;
-            }
-        }
-        return (unsigned) maxx - minx;
-    }
-
-    int height() const {
-        int miny = INT8_MAX;
-        int maxy = INT8_MIN;
-        for (int i = 0; i < offsets.size(); i++) {
-            int y = offsets[i].y;
-            if (y < miny) {
-                miny = y;
-            }
-            if (y > maxy) {
-                maxy = y;
-            }
-        }
-        return maxy - miny;
-    }
-};
-
 void encode_to_disk(const char *filename, const std::vector<unsigned char> &image, unsigned width, unsigned height);
 
 vector<uint8_t> get_window_pixels(const Image &image, const int x, const int y, const Window &window_offsets,
@@ -120,53 +35,6 @@ Image load_image(const char *filename);
 
 Window construct_border_window(int size);
 
-void resize(std::vector<unsigned char> &out, unsigned &outWidth, unsigned &outHeight,
-            const std::vector<unsigned char> &image, const unsigned width, const unsigned height,
-            const unsigned factor) {
-    const unsigned long length = image.size();
-
-    const int BYTES = 4;
-
-    outWidth = width / factor;
-    outHeight = height / factor;
-
-    out.reserve(outWidth * outHeight * BYTES);
-
-    for (unsigned long row = 0; row < height; ++row) {
-        if (row % (factor) == 0) {
-            for (unsigned long column = 0; column < width * BYTES; column += BYTES) {
-                if (column % (factor * BYTES) == 0) {
-                    const unsigned long i = row * width * BYTES + column;
-                    out.push_back(image.at(i));
-                    out.push_back(image.at(i + 1));
-                    out.push_back(image.at(i + 2));
-                    out.push_back(image.at(i + 3));
-                }
-            }
-        }
-    }
-
-}
-
-void decode(const char *filename, unsigned &width, unsigned &height, vector<unsigned char> &image) {
-    //decode
-    unsigned error = lodepng::decode(image, width, height, filename);
-
-    //if there's an error, display it
-    if (error) std::cout << "decoder error " << error << ": " << lodepng_error_text(error) << std::endl;
-
-    //the pixels are now in the vector "image", 4 bytes per pixel, ordered RGBARGBA..., use it as texture, draw it, ...
-}
-
-void rgb_to_grayscale(const vector<unsigned char> &rgb_image, vector<unsigned char> &gs_image) {
-
-    uint8_t gs_pixel;
-    for (int i = 0; i < rgb_image.size(); i += 4) {
-        gs_pixel = 0.2126 * rgb_image[i] + 0.7152 * rgb_image[i + 1] + 0.0722 * rgb_image[i + 2];
-        gs_image.push_back(gs_pixel);
-    }
-}
-
 void encode_gs_to_rgb(const vector<uint8_t> &gs_image, vector<uint8_t> &rgb_image) {
     rgb_image.clear();
     for (uint8_t pixel : gs_image) {
@@ -264,6 +132,21 @@ double calculate_zncc(const vector<uint8_t> &L_pixels, const vector<uint8_t> &R_
     return upper_sum / (sqrt(lower_l_sum) * sqrt(lower_r_sum));
 }
 
+/* Sum of (L - L_mean) * (R - R_mean) over the window, the right window being shifted by disparity */
+int64_t calculate_cross_sum(const Image &L_image, const Image &R_image, const int x, const int y,
+                            const Window &window, const int disparity, const int L_mean, const int R_mean) {
+    int64_t sum = 0;
+    for (int i = 0; i < window.offsets.size(); i++) {
+        Offset offset = window.offsets[i];
+        const int index = (y + offset.y) * L_image.width + x + offset.x;
+        sum += (L_image.pixels[index] - L_mean) * (R_image.pixels[index - disparity] - R_mean);
+    }
+    return sum;
+}
+
+/* Window means and deviations are looked up from the images' summed-area tables,
+ * so the window must be a filled rectangle such as the one given by construct_window()
+ */
 Image algorithm(const Image &L_image, const Image &R_image, const int &min_disp,
                 const int &max_disp, Window &window) {
     Image output;
@@ -281,8 +164,9 @@ Image algorithm(const Image &L_image, const Image &R_image, const int &min_disp,
                 continue;
             }
 
-            vector<uint8_t> L_window_pixels = get_window_pixels(L_image, x, y, window, 0);
-            float L_mean = calculate_mean_value(L_window_pixels);
+            const int x0 = x + window.minXOffset(), x1 = x + window.maxXOffset();
+            const int y0 = y + window.minYOffset(), y1 = y + window.maxYOffset();
+            WindowStats L_stats = L_image.integral.windowStats(x0, y0, x1, y1);
             double max_zncc = 0;
             uint8_t best_disp = 0;
 
@@ -293,11 +177,12 @@ Image algorithm(const Image &L_image, const Image &R_image, const int &min_disp,
                     continue;
                 }
 
-                vector<uint8_t> R_window_pixels = get_window_pixels(R_image, x, y, window, disp);
-                float R_mean = calculate_mean_value(R_window_pixels);
+                WindowStats R_stats = R_image.integral.windowStats(x0 - disp, y0, x1 - disp, y1);
 
                 // Calculate ZNCC for window
-                double zncc = calculate_zncc(L_window_pixels, R_window_pixels, L_mean, R_mean);
+                int64_t upper_sum = calculate_cross_sum(L_image, R_image, x, y, window, disp,
+                                                        L_stats.mean, R_stats.mean);
+                double zncc = upper_sum / (sqrt((double) L_stats.deviation) * sqrt((double) R_stats.deviation));
                 // Update current maximum sum
                 if (zncc > max_zncc) {
                     max_zncc = zncc;
@@ -362,18 +247,41 @@ float calculate_deviation(vector<uint8_t> &pixels, float mean, unsigned x_dispar
     return sqrt(sum / pixels.size());
 }
 
-Image load_image(const char *filename, unsigned int factor) {
-    unsigned original_width, original_height, smaller_width, smaller_height;
-    vector<unsigned char> image = vector<unsigned char>();
-    decode(filename, original_width, original_height, image);
-    vector<unsigned char> small_image = vector<unsigned char>();
-    resize(small_image, smaller_width, smaller_height, image, original_width, original_height, factor);
-    vector<uint8_t> gs_image = vector<unsigned char>();
-    rgb_to_grayscale(small_image, gs_image);
+Image load_image(const char *filename, unsigned int factor, DownsampleMode mode = POINT_SAMPLE) {
     Image gs;
-    gs.height = smaller_height;
-    gs.width = smaller_width;
-    gs.pixels = gs_image;
+    PngRowDecoder decoder;
+    unsigned error = decoder.open(filename);
+    if (!error && (decoder.width() < factor || decoder.height() < factor)) {
+        std::cerr << filename << " is " << decoder.width() << "x" << decoder.height()
+                  << ", smaller than the downsampling factor " << factor << endl;
+        return gs;
+    }
+    if (!error) {
+        gs.height = decoder.height() / factor;
+        gs.width = decoder.width() / factor;
+        gs.pixels = vector<unsigned char>(gs.width * gs.height);
+        if (mode == AREA_AVERAGE) {
+            // Every row of a block adds to the sums of its row of output pixels, the last one finishes it
+            vector<uint32_t> sums(gs.width * 4, 0);
+            error = decoder.decodeRows(1, [&gs, &sums, factor](unsigned y, const unsigned char *rgba) {
+                if (y / factor < gs.height) {
+                    accumulate_block_row(rgba, gs.width, factor, &sums[0]);
+                    if (y % factor == factor - 1) {
+                        area_grayscale_row(&sums[0], gs.width, factor, &gs.pixels[y / factor * gs.width]);
+                    }
+                }
+            });
+        } else {
+            // Only the rows that the downsampling samples are converted, the rest are just inflated
+            error = decoder.decodeRows(factor, [&gs, factor](unsigned y, const unsigned char *rgba) {
+                if (y / factor < gs.height) {
+                    downsample_grayscale_row(rgba, gs.width, factor, &gs.pixels[y / factor * gs.width]);
+                }
+            });
+        }
+    }
+    if (error) std::cout << "decoder error " << error << ": " << lodepng_error_text(error) << std::endl;
+    gs.integral = build_integral_image(gs.pixels, gs.width, gs.height);
     return gs;
 }
 
@@ -381,82 +289,101 @@ Image crossCheck(const Image &i1, const Image &i2, const int threshold, const ui
     Image crossChecked = Image();
     crossChecked.width = i1.width;
     crossChecked.height = i1.height;
-
-    for (int i = 0; i < i1.pixels.size(); i++) {
-        uint8_t p1 = i1.pixels[i];
-        uint8_t p2 = i2.pixels[i];
-        if (abs(p1 - p2) > threshold) {
-            crossChecked.pixels.push_back(0);
-        } else {
-            // Map from 0..ndisp to 0..255
-            crossChecked.pixels.push_back(p1 * 255 / ndisp);
-        }
+    crossChecked.pixels = vector<unsigned char>(i1.pixels.size());
+    for (unsigned i = 0; i < i1.pixels.size(); i++) {
+        crossChecked.pixels[i] = checked_disparity(i1, i2, i, threshold, ndisp);
     }
     return crossChecked;
 }
 
-/**
- * Absolute value of a two-valued vector (euclidean distance from (0,0)
- */
-double abs_dist(int x, int y) {
-    return sqrt(x*x + y*y);
-}
-
-uint8_t findNearestNonZeroPixel(const Image &image, const unsigned int x, const unsigned int y) {
-    double closest_dist = -1;
-    uint8_t closest_pixel = 0;
-    for (int offset = 0; ; offset++) {
-        double min_dist = offset;
-        if (closest_dist >= 0 && closest_dist <= min_dist) {
-            // We can no longer find a closer pixel within this offset
-            return closest_pixel;
-        }
-        for (int xsign = -offset; xsign <= offset; xsign++) {
-            for (int ysign = -offset; ysign <= offset; ysign++) {
-                if (abs(xsign) < offset && abs(ysign) < offset) {
-                    // Don't consider pixels already calculated
-                    continue;
-                }
-                uint8_t pixel = image.getPixel(x + xsign, y + ysign);
-                if (pixel != 0) {
-                    double dist = abs_dist(xsign, ysign);
-                    if (closest_dist < 0 || closest_dist > dist) {
-                        closest_dist = dist;
-                        closest_pixel = pixel;
-                    }
-                }
-            }
-        }
-    }
-}
-
-Image occlusionFill(const Image &image) {
-    Image filled = {};
-    filled.width = image.width;
-    filled.height = image.height;
-
-    for (unsigned int y = 0; y < image.height; y++) {
-        for (unsigned int x = 0; x < image.width; x++) {
-            uint8_t closest_pixel;
-            if (image.getPixel(x, y)) {
-                closest_pixel = image.getPixel(x, y);
-            } else {
-                closest_pixel = findNearestNonZeroPixel(image, x, y);
-            }
-            filled.pixels.push_back(closest_pixel);
-        }
+typedef Image (*DisparityEngine)(const Image &, const Image &, const int &, const int &, Window &);
+
+/* Maps an --engine name to the disparity algorithm implementing it, or NULL if there is none */
+DisparityEngine select_engine(const char *name) {
+    if (strcmp(name, "reference") == 0) {
+        return algorithm;
+    } else if (strcmp(name, "sliding") == 0) {
+        return sliding_algorithm;
+    } else if (strcmp(name, "simd") == 0) {
+        return simd_algorithm;
+    } else if (strcmp(name, "patch-cache") == 0) {
+        return patch_cache_algorithm;
+    } else if (strcmp(name, "fixed") == 0) {
+        return fixed_point_algorithm;
     }
-    return filled;
+    return NULL;
 }
 
 int main(int argc, char *argv[]) {
 
     Timer timer = Timer();
     timer.start();
-    const char *left_name = argc > 1 ? argv[1] : "im0.png";
-    const char *right_name = argc > 2 ? argv[2] : "im1.png";
-    const char *phase = argc > 3 ? argv[3] : "0";
-    const bool save = argc > 4;
+
+    // Options are given as --name=value, everything else is a positional argument
+    vector<const char *> args;
+    const char *engine_name = "symmetric";
+    unsigned threads = default_thread_count();
+    // Occlusion fill: the exact distance transform, or the original ring search
+    bool ring_fill = false;
+    // The input is reduced by factor in both directions, keeping one pixel of each block or the average
+    unsigned factor = 4;
+    DownsampleMode downsample = POINT_SAMPLE;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--engine=", 9) == 0) {
+            engine_name = argv[i] + 9;
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            threads = atoi(argv[i] + 10);
+            if (threads == 0) {
+                std::cerr << "Invalid thread count " << argv[i] + 10 << endl;
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--fill=", 7) == 0) {
+            ring_fill = strcmp(argv[i] + 7, "ring") == 0;
+            if (!ring_fill && strcmp(argv[i] + 7, "edt") != 0) {
+                std::cerr << "Unknown occlusion fill " << argv[i] + 7 << ", expected edt or ring" << endl;
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--factor=", 9) == 0) {
+            factor = atoi(argv[i] + 9);
+            if (factor == 0 || factor > 16) {
+                std::cerr << "Invalid downsampling factor " << argv[i] + 9 << ", expected 1 to 16" << endl;
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--downsample=", 13) == 0) {
+            downsample = strcmp(argv[i] + 13, "area") == 0 ? AREA_AVERAGE : POINT_SAMPLE;
+            if (downsample == POINT_SAMPLE && strcmp(argv[i] + 13, "point") != 0) {
+                std::cerr << "Unknown downsampling " << argv[i] + 13 << ", expected point or area" << endl;
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--cache-mb=", 11) == 0) {
+            set_patch_cache_limit((size_t) atoi(argv[i] + 11) * 1024 * 1024);
+        } else if (strncmp(argv[i], "--simd=", 7) == 0) {
+            if (!select_simd_variant(argv[i] + 7)) {
+                std::cerr << "SIMD variant " << argv[i] + 7 << " is not available on this CPU" << endl;
+                return 1;
+            }
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+
+    const char *left_name = args.size() > 0 ? args[0] : "im0.png";
+    const char *right_name = args.size() > 1 ? args[1] : "im1.png";
+    const char *phase = args.size() > 2 ? args[2] : "0";
+    const bool save = args.size() > 3;
+
+    // The parallel and symmetric engines compute both passes at once, the others are run once per pass
+    const bool parallel = strcmp(engine_name, "parallel") == 0;
+    const bool symmetric = strcmp(engine_name, "symmetric") == 0;
+    DisparityEngine engine = select_engine(engine_name);
+    if (!parallel && !symmetric && engine == NULL) {
+        std::cerr << "Unknown engine " << engine_name
+                  << ", expected parallel, symmetric, reference, sliding, simd, patch-cache or fixed" << endl;
+        return 1;
+    }
+    if (engine == simd_algorithm || engine == patch_cache_algorithm) {
+        cout << "Using " << simd_variant().name << " ZNCC kernel" << endl;
+    }
 
     timeval startTime, endTime, startPostProcessing, endCrossCheck;
 
@@ -470,17 +397,31 @@ int main(int argc, char *argv[]) {
     // Cross-check disparity threshold
     const int cc_thresh = 8;
 
+    // Rows per tile of the parallel engine and per band of the symmetric engine
+    const int tile_rows = 8;
+
     if (strcmp(phase, "0") == 0) {
         timer.checkPoint("Load images");
-        Image left = load_image(left_name, 4);
-        Image right = load_image(right_name, 4);
+        Image left = load_image(left_name, factor, downsample);
+        Image right = load_image(right_name, factor, downsample);
+        if (left.pixels.empty() || right.pixels.empty()) {
+            return 1;
+        }
         timer.checkPoint("Begin algorithm");
 
         //Here goes the algorithm
         Window window = construct_window(9, 9, left.width);
-        image1 = algorithm(left, right, 0, ndisp, window);
-        cout << "First image ready" << endl;
-        image2 = algorithm(right, left, -ndisp, 0, window);
+        if (parallel) {
+            cout << "Running on " << threads << " threads" << endl;
+            parallel_algorithm(left, right, ndisp, window, threads, tile_rows, image1, image2);
+        } else if (symmetric) {
+            cout << "Running on " << threads << " threads" << endl;
+            symmetric_algorithm(left, right, ndisp, window, threads, tile_rows, image1, image2);
+        } else {
+            image1 = engine(left, right, 0, ndisp, window);
+            cout << "First image ready" << endl;
+            image2 = engine(right, left, -ndisp, 0, window);
+        }
         phase = "1";
         if (save) {
             vector<uint8_t> image1_out, image2_out;
@@ -496,16 +437,16 @@ int main(int argc, char *argv[]) {
 
     timer.checkPoint("Begin post processing");
     if (strcmp(phase, "1") == 0) {
-        Image combined = crossCheck(image1, image2, cc_thresh, ndisp);
-
         if (save) {
+            // Only built to be saved, the fused stage below does not need it
+            Image combined = crossCheck(image1, image2, cc_thresh, ndisp);
             vector<uint8_t> image_out;
             encode_gs_to_rgb(combined.pixels, image_out);
             encode_to_disk("crosschecked.png", image_out, combined.width, combined.height);
         }
 
         timer.checkPoint("Begin occlusion fill");
-        Image filled = occlusionFill(combined);
+        Image filled = crossCheckFill(image1, image2, cc_thresh, ndisp, ring_fill);
         timer.checkPoint("Occlusion fill ready");
 
         vector<unsigned char> output_image = vector<unsigned char>();
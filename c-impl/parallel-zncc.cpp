@@ -0,0 +1,44 @@
+#include "parallel-zncc.h"
+
+#include <algorithm>
+#include "sliding-zncc.h"
+#include "thread-pool.h"
+
+using std::min;
+using std::vector;
+
+void parallel_algorithm(const Image &left, const Image &right, const int ndisp, Window &window,
+                        const unsigned threads, const int tile_rows, Image &left_disparity, Image &right_disparity) {
+    const WindowBounds bounds = window.bounds();
+    ThreadPool pool(threads);
+
+    PixelStats left_stats, right_stats;
+    pool.run({
+                     [&]() { left_stats = pixel_stats(left, bounds); },
+                     [&]() { right_stats = pixel_stats(right, bounds); }
+             });
+
+    for (Image *output : {&left_disparity, &right_disparity}) {
+        output->width = left.width;
+        output->height = left.height;
+        output->pixels = vector<unsigned char>(left.width * left.height, 0);
+    }
+    vector<double> left_max_zncc(left.width * left.height, 0);
+    vector<double> right_max_zncc(right.width * right.height, 0);
+
+    // Edge rows are mostly skipped and cost far less than centre rows, which is why tiles are
+    // kept small and left to work stealing rather than split evenly between threads up front
+    vector<Task> tiles;
+    for (int y = 0; y < (int) left.height; y += tile_rows) {
+        const int y_end = min(y + tile_rows, (int) left.height);
+        tiles.push_back([&, y, y_end]() {
+            sliding_rows(left, right, left_stats, right_stats, 0, ndisp, bounds, y, y_end,
+                         left_max_zncc, left_disparity);
+        });
+        tiles.push_back([&, y, y_end]() {
+            sliding_rows(right, left, right_stats, left_stats, -ndisp, 0, bounds, y, y_end,
+                         right_max_zncc, right_disparity);
+        });
+    }
+    pool.run(tiles);
+}
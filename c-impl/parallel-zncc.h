@@ -0,0 +1,14 @@
+#ifndef C_IMPL_PARALLEL_ZNCC_H
+#define C_IMPL_PARALLEL_ZNCC_H
+
+#include "image.h"
+#include "window.h"
+
+/* Computes both disparity maps, left against right over 0..ndisp and right against left over
+ * -ndisp..0, with the sliding engine. Both passes are split into tiles of tile_rows rows that run
+ * together on a work-stealing thread pool. Output is identical to running sliding_algorithm() twice.
+ */
+void parallel_algorithm(const Image &left, const Image &right, const int ndisp, Window &window,
+                        const unsigned threads, const int tile_rows, Image &left_disparity, Image &right_disparity);
+
+#endif //C_IMPL_PARALLEL_ZNCC_H
@@ -0,0 +1,109 @@
+#include "patch-cache.h"
+
+#include <stdlib.h>
+#include "simd-zncc.h"
+
+using std::vector;
+
+static const int CACHE_LINE = 64;
+
+static size_t patch_cache_limit = (size_t) 256 * 1024 * 1024;
+
+void set_patch_cache_limit(const size_t bytes) {
+    patch_cache_limit = bytes;
+}
+
+int PatchCache::patchStride(const WindowBounds &bounds) {
+    const int values_per_line = CACHE_LINE / sizeof(int16_t);
+    const int size = (bounds.maxX - bounds.minX + 1) * (bounds.maxY - bounds.minY + 1);
+    return (size + values_per_line - 1) / values_per_line * values_per_line;
+}
+
+size_t PatchCache::requiredBytes(const unsigned width, const unsigned height, const WindowBounds &bounds) {
+    return (size_t) width * height * patchStride(bounds) * sizeof(int16_t) + CACHE_LINE;
+}
+
+void PatchCache::build(const Image &image, const PixelStats &stats, const WindowBounds &bounds) {
+    width = image.width;
+    stride = patchStride(bounds);
+    storage = vector<int16_t>((size_t) image.width * image.height * stride + CACHE_LINE / sizeof(int16_t), 0);
+    // Align the pool to a cache line, vector storage only guarantees the alignment of int16_t
+    const uintptr_t address = (uintptr_t) &storage[0];
+    pool = (int16_t *) ((address + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE);
+
+    for (int y = -bounds.minY; y < (int) image.height - bounds.maxY; y++) {
+        for (int x = -bounds.minX; x < (int) image.width - bounds.maxX; x++) {
+            build_patch(image, stats, bounds, x, y, pool + ((size_t) y * width + x) * stride);
+        }
+    }
+}
+
+void build_patch(const Image &image, const PixelStats &stats, const WindowBounds &bounds, const int x, const int y,
+                 int16_t *patch) {
+    const int mean = stats.mean[y * image.width + x];
+    int i = 0;
+    for (int y1 = y + bounds.minY; y1 <= y + bounds.maxY; y1++) {
+        for (int x1 = x + bounds.minX; x1 <= x + bounds.maxX; x1++) {
+            patch[i++] = image.pixels[y1 * image.width + x1] - mean;
+        }
+    }
+    // Padding stays zero so it adds nothing to the dot product
+}
+
+Image patch_cache_algorithm(const Image &L_image, const Image &R_image, const int &min_disp,
+                            const int &max_disp, Window &window) {
+    const DotProductKernel dot_product = simd_variant().dot_product;
+    const WindowBounds bounds = window.bounds();
+    const int stride = PatchCache::patchStride(bounds);
+
+    Image output;
+    output.width = L_image.width;
+    output.height = L_image.height;
+    output.pixels = vector<unsigned char>(output.width * output.height, 0);
+
+    PixelStats L_stats = pixel_stats(L_image, bounds);
+    PixelStats R_stats = pixel_stats(R_image, bounds);
+
+    const bool cached = PatchCache::requiredBytes(R_image.width, R_image.height, bounds) <= patch_cache_limit;
+    PatchCache R_cache;
+    if (cached) {
+        R_cache.build(R_image, R_stats, bounds);
+    }
+
+    // Scratch patches for the left window and, without the cache, the right window
+    vector<int16_t> scratch(2 * stride + CACHE_LINE / sizeof(int16_t), 0);
+    const uintptr_t address = (uintptr_t) &scratch[0];
+    int16_t *L_patch = (int16_t *) ((address + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE);
+    int16_t *R_scratch = L_patch + stride;
+
+    for (int y = -bounds.minY; y < (int) L_image.height - bounds.maxY; y++) {
+        for (int x = -bounds.minX; x < (int) L_image.width - bounds.maxX; x++) {
+            build_patch(L_image, L_stats, bounds, x, y, L_patch);
+            const double L_root_deviation = L_stats.root_deviation[y * L_image.width + x];
+            double max_zncc = 0;
+            uint8_t best_disp = 0;
+
+            for (int disp = min_disp; disp < max_disp; disp++) {
+                // Overflow control
+                if (x - disp + bounds.minX < 0 || x - disp + bounds.maxX >= (int) R_image.width) {
+                    continue;
+                }
+
+                const int16_t *R_patch = R_scratch;
+                if (cached) {
+                    R_patch = R_cache.patch(x - disp, y);
+                } else {
+                    build_patch(R_image, R_stats, bounds, x - disp, y, R_scratch);
+                }
+                const double R_root_deviation = R_stats.root_deviation[y * R_image.width + x - disp];
+                double zncc = dot_product(L_patch, R_patch, stride) / (L_root_deviation * R_root_deviation);
+                if (zncc > max_zncc) {
+                    max_zncc = zncc;
+                    best_disp = abs(disp);
+                }
+            }
+            output.pixels[y * output.width + x] = best_disp;
+        }
+    }
+    return output;
+}
@@ -0,0 +1,51 @@
+#ifndef C_IMPL_PATCH_CACHE_H
+#define C_IMPL_PATCH_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include "image.h"
+#include "window.h"
+#include "sliding-zncc.h"
+
+/* Zero-mean windows of every pixel of an image, each packed into a contiguous run of int16 values
+ * padded to a whole number of cache lines. With the truncated window mean, p - mean is an exact
+ * integer, so the ZNCC numerator of two windows becomes a single dot product of their patches.
+ */
+class PatchCache {
+private:
+    std::vector<int16_t> storage;
+    int16_t *pool = NULL;
+    unsigned width = 0;
+    int stride = 0;
+
+public:
+    /* Number of int16 values per patch, window size rounded up to a multiple of 32 (64 bytes) */
+    static int patchStride(const WindowBounds &bounds);
+
+    /* Bytes needed to cache every pixel of an image of the given size */
+    static size_t requiredBytes(unsigned width, unsigned height, const WindowBounds &bounds);
+
+    void build(const Image &image, const PixelStats &stats, const WindowBounds &bounds);
+
+    const int16_t *patch(int x, int y) const {
+        return pool + ((size_t) y * width + x) * stride;
+    }
+};
+
+/* Writes the zero-mean window of pixel (x, y) to patch, which must hold PatchCache::patchStride() values */
+void build_patch(const Image &image, const PixelStats &stats, const WindowBounds &bounds, int x, int y,
+                 int16_t *patch);
+
+/* Caps the memory the patch cache may use. Passes that would need more build each right-image patch
+ * on the fly instead.
+ */
+void set_patch_cache_limit(size_t bytes);
+
+/* Disparity engine that computes the ZNCC numerator as a dot product of zero-mean patches, with the
+ * right-image patches precomputed once per pass when they fit in the cache limit. The window must be a
+ * filled rectangle. Produces identical output to algorithm().
+ */
+Image patch_cache_algorithm(const Image &L_image, const Image &R_image, const int &min_disp,
+                            const int &max_disp, Window &window);
+
+#endif //C_IMPL_PATCH_CACHE_H
@@ -0,0 +1,66 @@
+#include "post-process.h"
+#include "distance-transform.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+/* Value of the nearest pixel that passes the cross-check, searched in growing rings around (x, y) */
+static uint8_t nearest_checked(const Image &left, const Image &right, int threshold, int ndisp, int x, int y) {
+    const int width = left.width, height = left.height;
+    double closest_dist = -1;
+    uint8_t closest_pixel = 0;
+    // Past the larger dimension the rings hold no more pixels, which only happens if none passes
+    for (int offset = 0; offset <= std::max(width, height); offset++) {
+        if (closest_dist >= 0 && closest_dist <= offset) {
+            // We can no longer find a closer pixel within this offset
+            break;
+        }
+        for (int xsign = -offset; xsign <= offset; xsign++) {
+            for (int ysign = -offset; ysign <= offset; ysign++) {
+                if (abs(xsign) < offset && abs(ysign) < offset) {
+                    // Don't consider pixels already calculated
+                    continue;
+                }
+                const int x2 = x + xsign, y2 = y + ysign;
+                if (x2 < 0 || x2 >= width || y2 < 0 || y2 >= height) {
+                    continue;
+                }
+                uint8_t pixel = checked_disparity(left, right, y2 * width + x2, threshold, ndisp);
+                if (pixel != 0) {
+                    double dist = sqrt(xsign * xsign + ysign * ysign);
+                    if (closest_dist < 0 || closest_dist > dist) {
+                        closest_dist = dist;
+                        closest_pixel = pixel;
+                    }
+                }
+            }
+        }
+    }
+    return closest_pixel;
+}
+
+Image crossCheckFill(const Image &left, const Image &right, int threshold, int ndisp, bool ring_fill) {
+    Image filled = {};
+    filled.width = left.width;
+    filled.height = left.height;
+    filled.pixels = std::vector<unsigned char>(left.pixels.size());
+
+    for (unsigned i = 0; i < filled.pixels.size(); i++) {
+        filled.pixels[i] = checked_disparity(left, right, i, threshold, ndisp);
+    }
+
+    if (!ring_fill) {
+        distanceTransformFill(filled);
+        return filled;
+    }
+    for (unsigned y = 0; y < filled.height; y++) {
+        for (unsigned x = 0; x < filled.width; x++) {
+            unsigned char &pixel = filled.pixels[y * filled.width + x];
+            if (!pixel) {
+                pixel = nearest_checked(left, right, threshold, ndisp, x, y);
+            }
+        }
+    }
+    return filled;
+}
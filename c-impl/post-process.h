@@ -0,0 +1,24 @@
+#ifndef C_IMPL_POST_PROCESS_H
+#define C_IMPL_POST_PROCESS_H
+
+#include <cstdlib>
+
+#include "image.h"
+
+/* Cross-checked disparity of pixel i, scaled from 0..ndisp to 0..255, or 0 where the left and right
+ * maps differ by more than threshold
+ */
+inline uint8_t checked_disparity(const Image &left, const Image &right, unsigned i, int threshold, int ndisp) {
+    const uint8_t p1 = left.pixels[i], p2 = right.pixels[i];
+    return abs(p1 - p2) > threshold ? 0 : p1 * 255 / ndisp;
+}
+
+/* Cross-checks the two disparity maps and fills the pixels that fail the check in one stage. The
+ * checked disparities are written straight into the result, which the fill then completes in place,
+ * so no cross-checked image is built in between. With ring_fill the original ring search is used. It
+ * evaluates the check of each neighbour from the two maps as it goes, since the result already holds
+ * filled pixels. Otherwise distanceTransformFill() runs on the result.
+ */
+Image crossCheckFill(const Image &left, const Image &right, int threshold, int ndisp, bool ring_fill);
+
+#endif //C_IMPL_POST_PROCESS_H
@@ -0,0 +1,158 @@
+#include "preprocess.h"
+
+#include <cstdint>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+static inline unsigned char luma(const unsigned char *pixel) {
+    return (unsigned char) ((pixel[0] * LUMA_R + pixel[1] * LUMA_G + pixel[2] * LUMA_B) >> LUMA_SHIFT);
+}
+
+static inline uint32_t load_pixel(const unsigned char *pixel) {
+    uint32_t value;
+    memcpy(&value, pixel, sizeof(value));
+    return value;
+}
+
+void downsample_grayscale_row(const unsigned char *rgba, const unsigned out_width, const unsigned factor,
+                              unsigned char *out) {
+    const unsigned step = factor * 4;
+    unsigned x = 0;
+#if defined(__SSE2__)
+    // Eight pixels at a time: gather them into two vectors, widen to 16 bits and multiply-add each
+    // RGBA quadruple with (R, G, B, 0) weights, which leaves R*wr + G*wg and B*wb in adjacent lanes
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weights = _mm_setr_epi16(LUMA_R, LUMA_G, LUMA_B, 0, LUMA_R, LUMA_G, LUMA_B, 0);
+    for (; x + 8 <= out_width; x += 8) {
+        const unsigned char *p = rgba + x * step;
+        __m128i sums[2];
+        for (int half = 0; half < 2; half++) {
+            const unsigned char *q = p + half * 4 * step;
+            __m128i pixels = _mm_setr_epi32(load_pixel(q), load_pixel(q + step),
+                                            load_pixel(q + 2 * step), load_pixel(q + 3 * step));
+            __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), weights);
+            __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), weights);
+            // Add the two partial sums of each pixel into its even lane, then gather the even lanes
+            lo = _mm_shuffle_epi32(_mm_add_epi32(lo, _mm_srli_epi64(lo, 32)), _MM_SHUFFLE(3, 3, 2, 0));
+            hi = _mm_shuffle_epi32(_mm_add_epi32(hi, _mm_srli_epi64(hi, 32)), _MM_SHUFFLE(3, 3, 2, 0));
+            sums[half] = _mm_srli_epi32(_mm_unpacklo_epi64(lo, hi), LUMA_SHIFT);
+        }
+        __m128i gray = _mm_packs_epi32(sums[0], sums[1]);
+        _mm_storel_epi64((__m128i *) (out + x), _mm_packus_epi16(gray, gray));
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    // Eight pixels at a time: gather them so vld4 can split the channels, then widen and multiply-add
+    for (; x + 8 <= out_width; x += 8) {
+        uint32_t gathered[8];
+        for (int i = 0; i < 8; i++) {
+            gathered[i] = load_pixel(rgba + (x + i) * step);
+        }
+        uint8x8x4_t channels = vld4_u8((const uint8_t *) gathered);
+        uint16x8_t r = vmovl_u8(channels.val[0]), g = vmovl_u8(channels.val[1]), b = vmovl_u8(channels.val[2]);
+        uint32x4_t lo = vmull_n_u16(vget_low_u16(r), LUMA_R);
+        uint32x4_t hi = vmull_n_u16(vget_high_u16(r), LUMA_R);
+        lo = vmlal_n_u16(lo, vget_low_u16(g), LUMA_G);
+        hi = vmlal_n_u16(hi, vget_high_u16(g), LUMA_G);
+        lo = vmlal_n_u16(lo, vget_low_u16(b), LUMA_B);
+        hi = vmlal_n_u16(hi, vget_high_u16(b), LUMA_B);
+        uint16x8_t gray = vcombine_u16(vshrn_n_u32(lo, LUMA_SHIFT), vshrn_n_u32(hi, LUMA_SHIFT));
+        vst1_u8(out + x, vmovn_u16(gray));
+    }
+#endif
+    for (; x < out_width; x++) {
+        out[x] = luma(rgba + x * step);
+    }
+}
+
+/* Channel sums of the factor pixels starting at rgba */
+static inline void add_block(const unsigned char *rgba, const unsigned factor, uint32_t *sums) {
+    for (unsigned i = 0; i < factor; i++) {
+        for (int c = 0; c < 4; c++) {
+            sums[c] += rgba[i * 4 + c];
+        }
+    }
+}
+
+void accumulate_block_row(const unsigned char *rgba, const unsigned out_width, const unsigned factor,
+                          uint32_t *sums) {
+    unsigned x = 0;
+#if defined(__SSE2__)
+    // Eight input pixels at a time, widened to 16 bits. Adding the halves of each widened pair of
+    // pixels sums them per channel, which for 2x2 blocks already gives four output pixels. For 4x4
+    // blocks the two sums of each half of the input are added once more, giving two output pixels.
+    const __m128i zero = _mm_setzero_si128();
+    if (factor == 2) {
+        for (; x + 4 <= out_width; x += 4) {
+            __m128i pairs[2];
+            for (int half = 0; half < 2; half++) {
+                __m128i pixels = _mm_loadu_si128((const __m128i *) (rgba + x * 8 + half * 16));
+                __m128i lo = _mm_unpacklo_epi8(pixels, zero), hi = _mm_unpackhi_epi8(pixels, zero);
+                pairs[half] = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+            }
+            for (int i = 0; i < 4; i++) {
+                __m128i *sum = (__m128i *) (sums + (x + i) * 4);
+                __m128i pair = i % 2 == 0 ? _mm_unpacklo_epi16(pairs[i / 2], zero)
+                                          : _mm_unpackhi_epi16(pairs[i / 2], zero);
+                _mm_storeu_si128(sum, _mm_add_epi32(_mm_loadu_si128(sum), pair));
+            }
+        }
+    } else if (factor == 4) {
+        for (; x + 2 <= out_width; x += 2) {
+            __m128i halves[2];
+            for (int i = 0; i < 2; i++) {
+                __m128i pixels = _mm_loadu_si128((const __m128i *) (rgba + (x + i) * 16));
+                halves[i] = _mm_add_epi16(_mm_unpacklo_epi8(pixels, zero), _mm_unpackhi_epi8(pixels, zero));
+            }
+            __m128i blocks = _mm_add_epi16(_mm_unpacklo_epi64(halves[0], halves[1]),
+                                           _mm_unpackhi_epi64(halves[0], halves[1]));
+            __m128i *sum = (__m128i *) (sums + x * 4);
+            _mm_storeu_si128(sum, _mm_add_epi32(_mm_loadu_si128(sum), _mm_unpacklo_epi16(blocks, zero)));
+            _mm_storeu_si128(sum + 1, _mm_add_epi32(_mm_loadu_si128(sum + 1), _mm_unpackhi_epi16(blocks, zero)));
+        }
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    // vld4 splits sixteen input pixels into their channels and the pairwise widening adds sum
+    // neighbouring pixels, once for 2x2 blocks and twice for 4x4 blocks. vld4 and vst4 also split and
+    // interleave the channels of the sums.
+    if (factor == 2) {
+        for (; x + 8 <= out_width; x += 8) {
+            uint8x16x4_t pixels = vld4q_u8(rgba + x * 8);
+            for (int half = 0; half < 2; half++) {
+                uint32x4x4_t sum = vld4q_u32(sums + (x + half * 4) * 4);
+                for (int c = 0; c < 4; c++) {
+                    uint16x8_t pairs = vpaddlq_u8(pixels.val[c]);
+                    sum.val[c] = vaddw_u16(sum.val[c], half == 0 ? vget_low_u16(pairs) : vget_high_u16(pairs));
+                }
+                vst4q_u32(sums + (x + half * 4) * 4, sum);
+            }
+        }
+    } else if (factor == 4) {
+        for (; x + 4 <= out_width; x += 4) {
+            uint8x16x4_t pixels = vld4q_u8(rgba + x * 16);
+            uint32x4x4_t sum = vld4q_u32(sums + x * 4);
+            for (int c = 0; c < 4; c++) {
+                sum.val[c] = vaddq_u32(sum.val[c], vpaddlq_u16(vpaddlq_u8(pixels.val[c])));
+            }
+            vst4q_u32(sums + x * 4, sum);
+        }
+    }
+#endif
+    for (; x < out_width; x++) {
+        add_block(rgba + x * factor * 4, factor, sums + x * 4);
+    }
+}
+
+void area_grayscale_row(uint32_t *sums, const unsigned out_width, const unsigned factor, unsigned char *out) {
+    const uint64_t block = (uint64_t) factor * factor << LUMA_SHIFT;
+    for (unsigned x = 0; x < out_width; x++) {
+        const uint32_t *sum = sums + x * 4;
+        out[x] = (unsigned char) (((uint64_t) sum[0] * LUMA_R + (uint64_t) sum[1] * LUMA_G
+                                   + (uint64_t) sum[2] * LUMA_B) / block);
+    }
+    memset(sums, 0, out_width * 4 * sizeof(uint32_t));
+}
@@ -0,0 +1,33 @@
+#ifndef C_IMPL_PREPROCESS_H
+#define C_IMPL_PREPROCESS_H
+
+#include <cstdint>
+
+/* Luma weights 0.2126, 0.7152 and 0.0722 in units of 1/32768. They add up to exactly 32768, so
+ * grey input keeps its value, and they fit in int16 for the SIMD multiply-add.
+ */
+static const int LUMA_R = 6966, LUMA_G = 23436, LUMA_B = 2366;
+static const int LUMA_SHIFT = 15;
+
+/* Writes the grayscale value of every factor-th pixel of an RGBA scanline to out, out_width pixels
+ * in total. Resizing and grayscale conversion happen in one pass straight from the decoded row.
+ */
+void downsample_grayscale_row(const unsigned char *rgba, unsigned out_width, unsigned factor, unsigned char *out);
+
+/* How each factor x factor block of the input becomes one pixel: its top left pixel, or the average */
+enum DownsampleMode {
+    POINT_SAMPLE, AREA_AVERAGE
+};
+
+/* Adds the channel sums of every factor consecutive pixels of an RGBA scanline to sums, which holds
+ * four sums (R, G, B and A) for each of the out_width output pixels. Once all factor rows of a block
+ * have been added, area_grayscale_row turns the sums into the average grayscale values.
+ */
+void accumulate_block_row(const unsigned char *rgba, unsigned out_width, unsigned factor, uint32_t *sums);
+
+/* Writes the grayscale value of the average of each factor x factor block summed in sums to out, and
+ * clears the sums for the next row of blocks
+ */
+void area_grayscale_row(uint32_t *sums, unsigned out_width, unsigned factor, unsigned char *out);
+
+#endif //C_IMPL_PREPROCESS_H
@@ -0,0 +1,302 @@
+#include "simd-zncc.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_ZNCC_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SIMD_ZNCC_NEON
+#include <arm_neon.h>
+#endif
+
+static uint32_t cross_sum_scalar(const uint8_t *left, const uint8_t *right, const unsigned left_stride,
+                                 const unsigned right_stride, const int width, const int height) {
+    uint32_t sum = 0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            sum += left[y * left_stride + x] * right[y * right_stride + x];
+        }
+    }
+    return sum;
+}
+
+static int32_t dot_product_scalar(const int16_t *a, const int16_t *b, const int length) {
+    int32_t sum = 0;
+    for (int i = 0; i < length; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+#ifdef SIMD_ZNCC_X86
+
+/* The vector variants widen bytes to 16 bits and use pmaddwd, which multiplies and adds pairs of
+ * products into 32-bit lanes. Products of 8-bit values fit in 16 bits unsigned and pairs of them
+ * in 32 bits, so the sums are exact. Rows are consumed in full vectors, then 8-byte halves, and
+ * whatever remains is added in scalar code so no byte outside the patch is ever read.
+ */
+
+__attribute__((target("sse2")))
+static uint32_t cross_sum_sse2(const uint8_t *left, const uint8_t *right, const unsigned left_stride,
+                               const unsigned right_stride, const int width, const int height) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    uint32_t tail = 0;
+    for (int y = 0; y < height; y++) {
+        const uint8_t *l = left + y * left_stride, *r = right + y * right_stride;
+        int x = 0;
+        for (; x + 16 <= width; x += 16) {
+            __m128i lv = _mm_loadu_si128((const __m128i *) (l + x));
+            __m128i rv = _mm_loadu_si128((const __m128i *) (r + x));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi8(lv, zero), _mm_unpacklo_epi8(rv, zero)));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpackhi_epi8(lv, zero), _mm_unpackhi_epi8(rv, zero)));
+        }
+        if (x + 8 <= width) {
+            __m128i lv = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (l + x)), zero);
+            __m128i rv = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (r + x)), zero);
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(lv, rv));
+            x += 8;
+        }
+        for (; x < width; x++) {
+            tail += l[x] * r[x];
+        }
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (uint32_t) _mm_cvtsi128_si32(acc) + tail;
+}
+
+__attribute__((target("avx2")))
+static uint32_t cross_sum_avx2(const uint8_t *left, const uint8_t *right, const unsigned left_stride,
+                               const unsigned right_stride, const int width, const int height) {
+    __m256i acc = _mm256_setzero_si256();
+    __m128i half_acc = _mm_setzero_si128();
+    uint32_t tail = 0;
+    for (int y = 0; y < height; y++) {
+        const uint8_t *l = left + y * left_stride, *r = right + y * right_stride;
+        int x = 0;
+        for (; x + 16 <= width; x += 16) {
+            __m256i lv = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (l + x)));
+            __m256i rv = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (r + x)));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(lv, rv));
+        }
+        if (x + 8 <= width) {
+            __m128i lv = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *) (l + x)));
+            __m128i rv = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *) (r + x)));
+            half_acc = _mm_add_epi32(half_acc, _mm_madd_epi16(lv, rv));
+            x += 8;
+        }
+        for (; x < width; x++) {
+            tail += l[x] * r[x];
+        }
+    }
+    __m128i sum = _mm_add_epi32(half_acc, _mm_add_epi32(_mm256_castsi256_si128(acc),
+                                                        _mm256_extracti128_si256(acc, 1)));
+    sum = _mm_hadd_epi32(sum, sum);
+    sum = _mm_hadd_epi32(sum, sum);
+    return (uint32_t) _mm_cvtsi128_si32(sum) + tail;
+}
+
+__attribute__((target("sse2")))
+static int32_t dot_product_sse2(const int16_t *a, const int16_t *b, const int length) {
+    __m128i acc = _mm_setzero_si128();
+    for (int i = 0; i < length; i += 8) {
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_load_si128((const __m128i *) (a + i)),
+                                                _mm_load_si128((const __m128i *) (b + i))));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(acc);
+}
+
+__attribute__((target("avx2")))
+static int32_t dot_product_avx2(const int16_t *a, const int16_t *b, const int length) {
+    __m256i acc = _mm256_setzero_si256();
+    for (int i = 0; i < length; i += 16) {
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_load_si256((const __m256i *) (a + i)),
+                                                      _mm256_load_si256((const __m256i *) (b + i))));
+    }
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_hadd_epi32(sum, sum);
+    sum = _mm_hadd_epi32(sum, sum);
+    return _mm_cvtsi128_si32(sum);
+}
+
+/* Masked byte loads let AVX-512 consume the ragged end of each row without a scalar tail */
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+static uint32_t cross_sum_avx512(const uint8_t *left, const uint8_t *right, const unsigned left_stride,
+                                 const unsigned right_stride, const int width, const int height) {
+    __m512i acc = _mm512_setzero_si512();
+    for (int y = 0; y < height; y++) {
+        const uint8_t *l = left + y * left_stride, *r = right + y * right_stride;
+        for (int x = 0; x < width; x += 32) {
+            const int remaining = width - x;
+            const __mmask32 mask = remaining >= 32 ? 0xFFFFFFFFu : (1u << remaining) - 1;
+            __m512i lv = _mm512_cvtepu8_epi16(_mm256_maskz_loadu_epi8(mask, l + x));
+            __m512i rv = _mm512_cvtepu8_epi16(_mm256_maskz_loadu_epi8(mask, r + x));
+            acc = _mm512_add_epi32(acc, _mm512_madd_epi16(lv, rv));
+        }
+    }
+    return (uint32_t) _mm512_reduce_add_epi32(acc);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static int32_t dot_product_avx512(const int16_t *a, const int16_t *b, const int length) {
+    __m512i acc = _mm512_setzero_si512();
+    for (int i = 0; i < length; i += 32) {
+        acc = _mm512_add_epi32(acc, _mm512_madd_epi16(_mm512_load_si512(a + i), _mm512_load_si512(b + i)));
+    }
+    return _mm512_reduce_add_epi32(acc);
+}
+
+#endif
+
+#ifdef SIMD_ZNCC_NEON
+
+/* vmull_u8 widens the products to 16 bits and vpadalq_u16 adds adjacent pairs into 32-bit lanes */
+static uint32_t cross_sum_neon(const uint8_t *left, const uint8_t *right, const unsigned left_stride,
+                               const unsigned right_stride, const int width, const int height) {
+    uint32x4_t acc = vdupq_n_u32(0);
+    uint32_t tail = 0;
+    for (int y = 0; y < height; y++) {
+        const uint8_t *l = left + y * left_stride, *r = right + y * right_stride;
+        int x = 0;
+        for (; x + 16 <= width; x += 16) {
+            uint8x16_t lv = vld1q_u8(l + x);
+            uint8x16_t rv = vld1q_u8(r + x);
+            acc = vpadalq_u16(acc, vmull_u8(vget_low_u8(lv), vget_low_u8(rv)));
+            acc = vpadalq_u16(acc, vmull_u8(vget_high_u8(lv), vget_high_u8(rv)));
+        }
+        if (x + 8 <= width) {
+            acc = vpadalq_u16(acc, vmull_u8(vld1_u8(l + x), vld1_u8(r + x)));
+            x += 8;
+        }
+        for (; x < width; x++) {
+            tail += l[x] * r[x];
+        }
+    }
+    uint32x2_t sum = vadd_u32(vget_low_u32(acc), vget_high_u32(acc));
+    sum = vpadd_u32(sum, sum);
+    return vget_lane_u32(sum, 0) + tail;
+}
+
+static int32_t dot_product_neon(const int16_t *a, const int16_t *b, const int length) {
+    int32x4_t acc = vdupq_n_s32(0);
+    for (int i = 0; i < length; i += 8) {
+        int16x8_t av = vld1q_s16(a + i);
+        int16x8_t bv = vld1q_s16(b + i);
+        acc = vmlal_s16(acc, vget_low_s16(av), vget_low_s16(bv));
+        acc = vmlal_s16(acc, vget_high_s16(av), vget_high_s16(bv));
+    }
+    int32x2_t sum = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+    sum = vpadd_s32(sum, sum);
+    return vget_lane_s32(sum, 0);
+}
+
+#endif
+
+static bool variant_supported(const char *name) {
+#ifdef SIMD_ZNCC_X86
+    if (strcmp(name, "avx512") == 0) {
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+               && __builtin_cpu_supports("avx512vl");
+    } else if (strcmp(name, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2");
+    } else if (strcmp(name, "sse2") == 0) {
+        return __builtin_cpu_supports("sse2");
+    }
+#endif
+    return true;
+}
+
+// Fastest first, the scalar fallback always last
+static const SimdVariant variants[] = {
+#ifdef SIMD_ZNCC_X86
+        {"avx512", cross_sum_avx512, dot_product_avx512},
+        {"avx2",   cross_sum_avx2,   dot_product_avx2},
+        {"sse2",   cross_sum_sse2,   dot_product_sse2},
+#endif
+#ifdef SIMD_ZNCC_NEON
+        {"neon",   cross_sum_neon,   dot_product_neon},
+#endif
+        {"scalar", cross_sum_scalar, dot_product_scalar},
+};
+
+static const SimdVariant *detect_variant() {
+#ifdef SIMD_ZNCC_X86
+    // Runs from a static initializer, possibly before libgcc has read CPUID itself
+    __builtin_cpu_init();
+#endif
+    for (const SimdVariant &variant : variants) {
+        if (variant_supported(variant.name)) {
+            return &variant;
+        }
+    }
+    return &variants[sizeof(variants) / sizeof(variants[0]) - 1];
+}
+
+static const SimdVariant *selected_variant = detect_variant();
+
+const SimdVariant &simd_variant() {
+    return *selected_variant;
+}
+
+bool select_simd_variant(const char *name) {
+    for (const SimdVariant &variant : variants) {
+        if (strcmp(variant.name, name) == 0 && variant_supported(name)) {
+            selected_variant = &variant;
+            return true;
+        }
+    }
+    return false;
+}
+
+Image simd_algorithm(const Image &L_image, const Image &R_image, const int &min_disp,
+                     const int &max_disp, Window &window) {
+    const CrossSumKernel cross_sum = selected_variant->cross_sum;
+    const int minX = window.minXOffset(), maxX = window.maxXOffset();
+    const int minY = window.minYOffset(), maxY = window.maxYOffset();
+    const int win_width = maxX - minX + 1, win_height = maxY - minY + 1;
+    const int64_t count = win_width * win_height;
+
+    Image output;
+    output.width = L_image.width;
+    output.height = L_image.height;
+    output.pixels = std::vector<unsigned char>(output.width * output.height, 0);
+
+    for (int y = -minY; y < (int) L_image.height - maxY; y++) {
+        for (int x = -minX; x < (int) L_image.width - maxX; x++) {
+            WindowStats L_stats = L_image.integral.windowStats(x + minX, y + minY, x + maxX, y + maxY);
+            const double L_root_deviation = sqrt((double) L_stats.deviation);
+            const uint8_t *L_patch = &L_image.pixels[(y + minY) * L_image.width + x + minX];
+            double max_zncc = 0;
+            uint8_t best_disp = 0;
+
+            for (int disp = min_disp; disp < max_disp; disp++) {
+                // Overflow control
+                if (x - disp + minX < 0 || x - disp + maxX >= (int) R_image.width) {
+                    continue;
+                }
+
+                WindowStats R_stats = R_image.integral.windowStats(x + minX - disp, y + minY,
+                                                                   x + maxX - disp, y + maxY);
+                const uint8_t *R_patch = &R_image.pixels[(y + minY) * R_image.width + x + minX - disp];
+                const int64_t L_mean = L_stats.mean, R_mean = R_stats.mean;
+                // sum((L - L_mean) * (R - R_mean)) expanded in terms of the window sums
+                const int64_t upper_sum = (int64_t) cross_sum(L_patch, R_patch, L_image.width, R_image.width,
+                                                              win_width, win_height)
+                                          - L_mean * R_stats.sum - R_mean * L_stats.sum + count * L_mean * R_mean;
+                double zncc = upper_sum / (L_root_deviation * sqrt((double) R_stats.deviation));
+                if (zncc > max_zncc) {
+                    max_zncc = zncc;
+                    best_disp = abs(disp);
+                }
+            }
+            output.pixels[y * output.width + x] = best_disp;
+        }
+    }
+    return output;
+}
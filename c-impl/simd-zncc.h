@@ -0,0 +1,40 @@
+#ifndef C_IMPL_SIMD_ZNCC_H
+#define C_IMPL_SIMD_ZNCC_H
+
+#include <cstdint>
+#include "image.h"
+#include "window.h"
+
+/* Computes sum(L * R) over a width x height patch of two 8-bit images, given pointers to the
+ * top-left pixels of both patches and the row strides of the images
+ */
+typedef uint32_t (*CrossSumKernel)(const uint8_t *left, const uint8_t *right, unsigned left_stride,
+                                   unsigned right_stride, int width, int height);
+
+/* Computes the dot product of two int16 vectors. The length must be a multiple of 32 and both
+ * vectors must be 64-byte aligned.
+ */
+typedef int32_t (*DotProductKernel)(const int16_t *a, const int16_t *b, int length);
+
+struct SimdVariant {
+    const char *name;
+    CrossSumKernel cross_sum;
+    DotProductKernel dot_product;
+};
+
+/* The fastest variant supported by this CPU, picked once from CPUID at startup */
+const SimdVariant &simd_variant();
+
+/* Overrides the variant picked at startup, e.g. for benchmarking. Returns false if the named
+ * variant is unknown or not supported by this CPU.
+ */
+bool select_simd_variant(const char *name);
+
+/* Disparity engine that evaluates every window like algorithm(), but computes the cross term
+ * with the vectorized kernel directly on the image rows and reads means and deviations from the
+ * summed-area tables. The window must be a filled rectangle. Produces identical output to algorithm().
+ */
+Image simd_algorithm(const Image &L_image, const Image &R_image, const int &min_disp,
+                     const int &max_disp, Window &window);
+
+#endif //C_IMPL_SIMD_ZNCC_H
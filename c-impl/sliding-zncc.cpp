@@ -0,0 +1,115 @@
+#include "sliding-zncc.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <algorithm>
+
+using std::max;
+using std::min;
+using std::vector;
+
+PixelStats pixel_stats(const Image &image, const WindowBounds &bounds) {
+    PixelStats stats;
+    const unsigned size = image.width * image.height;
+    stats.mean = vector<int>(size, 0);
+    stats.sum = vector<uint32_t>(size, 0);
+    stats.root_deviation = vector<double>(size, 0);
+
+    for (int y = -bounds.minY; y < (int) image.height - bounds.maxY; y++) {
+        for (int x = -bounds.minX; x < (int) image.width - bounds.maxX; x++) {
+            WindowStats s = image.integral.windowStats(x + bounds.minX, y + bounds.minY,
+                                                       x + bounds.maxX, y + bounds.maxY);
+            stats.mean[y * image.width + x] = s.mean;
+            stats.sum[y * image.width + x] = s.sum;
+            stats.root_deviation[y * image.width + x] = sqrt((double) s.deviation);
+        }
+    }
+    return stats;
+}
+
+void sliding_rows(const Image &L_image, const Image &R_image, const PixelStats &L_stats, const PixelStats &R_stats,
+                  const int min_disp, const int max_disp, const WindowBounds &bounds, const int y_begin,
+                  const int y_end, vector<double> &max_zncc, Image &output) {
+    const int width = L_image.width, height = L_image.height;
+    const int minX = bounds.minX, maxX = bounds.maxX, minY = bounds.minY, maxY = bounds.maxY;
+    const int64_t count = (maxX - minX + 1) * (maxY - minY + 1);
+
+    // Rows whose window fits inside the image, edges are left at zero
+    const int first_row = max(y_begin, -minY), last_row = min(y_end, height - maxY);
+    if (first_row >= last_row) {
+        return;
+    }
+    vector<uint32_t> column_sums(width);
+
+    // Disparities are visited in the same order as in algorithm(), so ties resolve identically
+    for (int disp = min_disp; disp < max_disp; disp++) {
+        // Window centres for which both the left and the shifted right window are inside the images
+        const int x_start = max(-minX, disp - minX);
+        const int x_end = min(width - maxX, (int) R_image.width - maxX + disp);
+        if (x_start >= x_end) {
+            continue;
+        }
+        const int column_start = x_start + minX, column_end = x_end + maxX;
+
+        // Column sums over the rows of the first window
+        for (int column = column_start; column < column_end; column++) {
+            uint32_t sum = 0;
+            for (int row = first_row + minY; row <= first_row + maxY; row++) {
+                sum += L_image.pixels[row * width + column] * R_image.pixels[row * R_image.width + column - disp];
+            }
+            column_sums[column] = sum;
+        }
+
+        for (int y = first_row; y < last_row; y++) {
+            if (y > first_row) {
+                // Slide the column sums down by one row
+                const int removed = y + minY - 1, added = y + maxY;
+                for (int column = column_start; column < column_end; column++) {
+                    column_sums[column] +=
+                            L_image.pixels[added * width + column] * R_image.pixels[added * R_image.width + column - disp]
+                            - L_image.pixels[removed * width + column] * R_image.pixels[removed * R_image.width + column - disp];
+                }
+            }
+
+            uint64_t cross_sum = 0;
+            for (int column = x_start + minX; column < x_start + maxX; column++) {
+                cross_sum += column_sums[column];
+            }
+            for (int x = x_start; x < x_end; x++) {
+                // Slide the window sum right by one column
+                cross_sum += column_sums[x + maxX];
+                if (x > x_start) {
+                    cross_sum -= column_sums[x + minX - 1];
+                }
+
+                const int l = y * width + x, r = y * R_image.width + x - disp;
+                const int64_t L_mean = L_stats.mean[l], R_mean = R_stats.mean[r];
+                // sum((L - L_mean) * (R - R_mean)) expanded in terms of the window sums
+                const int64_t upper_sum = (int64_t) cross_sum - L_mean * R_stats.sum[r] - R_mean * L_stats.sum[l]
+                                          + count * L_mean * R_mean;
+                double zncc = upper_sum / (L_stats.root_deviation[l] * R_stats.root_deviation[r]);
+                if (zncc > max_zncc[l]) {
+                    max_zncc[l] = zncc;
+                    output.pixels[l] = abs(disp);
+                }
+            }
+        }
+    }
+}
+
+Image sliding_algorithm(const Image &L_image, const Image &R_image, const int &min_disp,
+                        const int &max_disp, Window &window) {
+    const WindowBounds bounds = window.bounds();
+
+    Image output;
+    output.width = L_image.width;
+    output.height = L_image.height;
+    output.pixels = vector<unsigned char>(output.width * output.height, 0);
+
+    PixelStats L_stats = pixel_stats(L_image, bounds);
+    PixelStats R_stats = pixel_stats(R_image, bounds);
+    vector<double> max_zncc(output.width * output.height, 0);
+    sliding_rows(L_image, R_image, L_stats, R_stats, min_disp, max_disp, bounds, 0, L_image.height,
+                 max_zncc, output);
+    return output;
+}
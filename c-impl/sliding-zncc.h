@@ -0,0 +1,32 @@
+#ifndef C_IMPL_SLIDING_ZNCC_H
+#define C_IMPL_SLIDING_ZNCC_H
+
+#include "image.h"
+#include "window.h"
+
+/* Per-pixel window statistics of an image, for windows that fit inside it */
+struct PixelStats {
+    std::vector<int> mean;
+    std::vector<uint32_t> sum;
+    std::vector<double> root_deviation;
+};
+
+PixelStats pixel_stats(const Image &image, const WindowBounds &bounds);
+
+/* Computes rows y_begin..y_end-1 of the disparity map into output, keeping the best score of each
+ * pixel in max_zncc. Disjoint row ranges touch disjoint parts of output and max_zncc, so they can
+ * be computed concurrently.
+ */
+void sliding_rows(const Image &L_image, const Image &R_image, const PixelStats &L_stats, const PixelStats &R_stats,
+                  const int min_disp, const int max_disp, const WindowBounds &bounds, const int y_begin,
+                  const int y_end, std::vector<double> &max_zncc, Image &output);
+
+/* Disparity engine that produces the same output as algorithm(), but keeps running column sums of
+ * L(x, y) * R(x - disp, y) for each disparity and slides them along x and y. Every ZNCC evaluation
+ * then costs a constant amount of work regardless of the window size.
+ * The window must be a filled rectangle, and both images must have their summed-area tables built.
+ */
+Image sliding_algorithm(const Image &L_image, const Image &R_image, const int &min_disp,
+                        const int &max_disp, Window &window);
+
+#endif //C_IMPL_SLIDING_ZNCC_H
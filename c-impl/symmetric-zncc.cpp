@@ -0,0 +1,140 @@
+#include "symmetric-zncc.h"
+
+#include <algorithm>
+#include "sliding-zncc.h"
+#include "thread-pool.h"
+
+using std::max;
+using std::min;
+using std::vector;
+
+/* Fills costs[(row * (ndisp + 1) + d) * width + x] with the score of left pixel x against right pixel
+ * x - d for the rows y_begin..y_end-1. Pairs where either window leaves the image score 0, which
+ * never wins against the initial maximum, just as the overflow check skips them.
+ */
+static void cost_band(const Image &left, const Image &right, const PixelStats &left_stats,
+                      const PixelStats &right_stats, const int ndisp, const WindowBounds &bounds,
+                      const int y_begin, const int y_end, vector<double> &costs) {
+    const int width = left.width;
+    const int minX = bounds.minX, maxX = bounds.maxX, minY = bounds.minY, maxY = bounds.maxY;
+    const int64_t count = (maxX - minX + 1) * (maxY - minY + 1);
+    std::fill(costs.begin(), costs.end(), 0);
+
+    const int first_row = max(y_begin, -minY), last_row = min(y_end, (int) left.height - maxY);
+    if (first_row >= last_row) {
+        return;
+    }
+    vector<uint32_t> column_sums(width);
+
+    for (int disp = 0; disp <= ndisp; disp++) {
+        const int x_start = disp - minX, x_end = width - maxX;
+        if (x_start >= x_end) {
+            continue;
+        }
+        const int column_start = x_start + minX, column_end = x_end + maxX;
+
+        for (int column = column_start; column < column_end; column++) {
+            uint32_t sum = 0;
+            for (int row = first_row + minY; row <= first_row + maxY; row++) {
+                sum += left.pixels[row * width + column] * right.pixels[row * width + column - disp];
+            }
+            column_sums[column] = sum;
+        }
+
+        for (int y = first_row; y < last_row; y++) {
+            if (y > first_row) {
+                const int removed = y + minY - 1, added = y + maxY;
+                for (int column = column_start; column < column_end; column++) {
+                    column_sums[column] +=
+                            left.pixels[added * width + column] * right.pixels[added * width + column - disp]
+                            - left.pixels[removed * width + column] * right.pixels[removed * width + column - disp];
+                }
+            }
+
+            double *scores = &costs[((y - y_begin) * (ndisp + 1) + disp) * width];
+            uint64_t cross_sum = 0;
+            for (int column = x_start + minX; column < x_start + maxX; column++) {
+                cross_sum += column_sums[column];
+            }
+            for (int x = x_start; x < x_end; x++) {
+                cross_sum += column_sums[x + maxX];
+                if (x > x_start) {
+                    cross_sum -= column_sums[x + minX - 1];
+                }
+
+                const int l = y * width + x, r = l - disp;
+                const int64_t L_mean = left_stats.mean[l], R_mean = right_stats.mean[r];
+                const int64_t upper_sum = (int64_t) cross_sum - L_mean * right_stats.sum[r]
+                                          - R_mean * left_stats.sum[l] + count * L_mean * R_mean;
+                // The numerator is exact and the product of the roots commutes, so the right to left
+                // pass would compute this very same value
+                scores[x] = upper_sum / (left_stats.root_deviation[l] * right_stats.root_deviation[r]);
+            }
+        }
+    }
+}
+
+/* Picks the best disparity of each pixel in both directions from the scores of a band */
+static void select_disparities(const vector<double> &costs, const int ndisp, const int width,
+                               const int y_begin, const int y_end, Image &left_disparity,
+                               Image &right_disparity) {
+    for (int y = y_begin; y < y_end; y++) {
+        const double *row = &costs[(y - y_begin) * (ndisp + 1) * width];
+        unsigned char *left_out = &left_disparity.pixels[y * width];
+        unsigned char *right_out = &right_disparity.pixels[y * width];
+
+        // Left to right visits 0..ndisp-1 in ascending order
+        vector<double> best(width, 0);
+        for (int disp = 0; disp < ndisp; disp++) {
+            const double *scores = row + disp * width;
+            for (int x = 0; x < width; x++) {
+                if (scores[x] > best[x]) {
+                    best[x] = scores[x];
+                    left_out[x] = disp;
+                }
+            }
+        }
+
+        // Right to left visits -ndisp..-1, so the right pixel x pairs with left pixel x + ndisp first
+        std::fill(best.begin(), best.end(), 0);
+        for (int disp = ndisp; disp > 0; disp--) {
+            const double *scores = row + disp * width;
+            for (int x = 0; x + disp < width; x++) {
+                if (scores[x + disp] > best[x]) {
+                    best[x] = scores[x + disp];
+                    right_out[x] = disp;
+                }
+            }
+        }
+    }
+}
+
+void symmetric_algorithm(const Image &left, const Image &right, const int ndisp, Window &window,
+                         const unsigned threads, const int band_rows, Image &left_disparity,
+                         Image &right_disparity) {
+    const WindowBounds bounds = window.bounds();
+    ThreadPool pool(threads);
+
+    PixelStats left_stats, right_stats;
+    pool.run({
+                     [&]() { left_stats = pixel_stats(left, bounds); },
+                     [&]() { right_stats = pixel_stats(right, bounds); }
+             });
+
+    for (Image *output : {&left_disparity, &right_disparity}) {
+        output->width = left.width;
+        output->height = left.height;
+        output->pixels = vector<unsigned char>(left.width * left.height, 0);
+    }
+
+    vector<Task> bands;
+    for (int y = 0; y < (int) left.height; y += band_rows) {
+        const int y_end = min(y + band_rows, (int) left.height);
+        bands.push_back([&, y, y_end]() {
+            vector<double> costs((size_t) (y_end - y) * (ndisp + 1) * left.width);
+            cost_band(left, right, left_stats, right_stats, ndisp, bounds, y, y_end, costs);
+            select_disparities(costs, ndisp, left.width, y, y_end, left_disparity, right_disparity);
+        });
+    }
+    pool.run(bands);
+}
@@ -0,0 +1,19 @@
+#ifndef C_IMPL_SYMMETRIC_ZNCC_H
+#define C_IMPL_SYMMETRIC_ZNCC_H
+
+#include "image.h"
+#include "window.h"
+
+/* Computes both disparity maps from a single evaluation of each correlation.
+ * ZNCC(L, R, x, y, d) equals ZNCC(R, L, x - d, y, -d), so for a band of band_rows rows the scores of
+ * every left pixel against every right pixel 0..ndisp columns to its left are computed once with
+ * sliding column sums and kept in a (ndisp + 1) x width block per row. Both argmax maps are then
+ * read from that block. Bands run on a work-stealing thread pool and memory is bounded by the band
+ * height. Output is identical to parallel_algorithm().
+ * Both images must have the same size.
+ */
+void symmetric_algorithm(const Image &left, const Image &right, const int ndisp, Window &window,
+                         const unsigned threads, const int band_rows, Image &left_disparity,
+                         Image &right_disparity);
+
+#endif //C_IMPL_SYMMETRIC_ZNCC_H
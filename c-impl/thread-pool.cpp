@@ -0,0 +1,64 @@
+#include "thread-pool.h"
+
+#include <thread>
+
+using std::vector;
+
+ThreadPool::ThreadPool(const unsigned threads) : threads(threads > 0 ? threads : 1), queues(this->threads) {
+}
+
+unsigned ThreadPool::size() const {
+    return threads;
+}
+
+bool ThreadPool::takeOwn(const unsigned worker, Task &task) {
+    WorkQueue &queue = queues[worker];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+    task = std::move(queue.tasks.front());
+    queue.tasks.pop_front();
+    return true;
+}
+
+bool ThreadPool::steal(const unsigned worker, Task &task) {
+    for (unsigned i = 1; i < threads; i++) {
+        WorkQueue &victim = queues[(worker + i) % threads];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::work(const unsigned worker) {
+    Task task;
+    // No new tasks arrive during a batch, so once every queue is empty the worker is done
+    while (takeOwn(worker, task) || steal(worker, task)) {
+        task();
+    }
+}
+
+void ThreadPool::run(const vector<Task> &tasks) {
+    for (unsigned i = 0; i < tasks.size(); i++) {
+        queues[i * threads / tasks.size()].tasks.push_back(tasks[i]);
+    }
+
+    vector<std::thread> workers;
+    for (unsigned worker = 1; worker < threads; worker++) {
+        workers.push_back(std::thread(&ThreadPool::work, this, worker));
+    }
+    work(0);
+    for (std::thread &thread : workers) {
+        thread.join();
+    }
+}
+
+unsigned default_thread_count() {
+    unsigned threads = std::thread::hardware_concurrency();
+    return threads > 0 ? threads : 1;
+}
@@ -0,0 +1,44 @@
+#ifndef C_IMPL_THREAD_POOL_H
+#define C_IMPL_THREAD_POOL_H
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+typedef std::function<void()> Task;
+
+/* Runs a batch of independent tasks on a number of threads with work stealing.
+ * Tasks are first dealt out to the workers in contiguous blocks. Each worker takes tasks from the
+ * front of its own queue, and once that is empty it steals from the back of the other queues, so
+ * tasks of very different cost still balance out.
+ */
+class ThreadPool {
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    unsigned threads;
+    std::vector<WorkQueue> queues;
+
+    bool takeOwn(unsigned worker, Task &task);
+
+    bool steal(unsigned worker, Task &task);
+
+    void work(unsigned worker);
+
+public:
+    explicit ThreadPool(unsigned threads);
+
+    unsigned size() const;
+
+    /* Runs all tasks, the calling thread acting as one of the workers, and returns once every task has finished */
+    void run(const std::vector<Task> &tasks);
+};
+
+/* Number of hardware threads, at least 1 */
+unsigned default_thread_count();
+
+#endif //C_IMPL_THREAD_POOL_H
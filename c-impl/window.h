@@ -0,0 +1,104 @@
+#ifndef C_IMPL_WINDOW_H
+#define C_IMPL_WINDOW_H
+
+#include <cstdint>
+#include <vector>
+
+struct Offset {
+    int x, y;
+};
+
+/* Bounding box of a window's offsets, resolved once so it can be shared between threads */
+struct WindowBounds {
+    int minX, minY, maxX, maxY;
+};
+
+struct Window {
+    std::vector<Offset> offsets;
+    int minX=0, minY=0, maxX=0, maxY=0;
+
+    int minXOffset() {
+        if (minX != 0) return minX;
+        int min = INT8_MAX;
+        for (int i = 0; i < offsets.size(); i++) {
+            if (offsets[i].x < min) {
+                min = offsets[i].x;
+            }
+        }
+        minX = min;
+        return min;
+    }
+
+    int minYOffset() {
+        if (minY != 0) return minY;
+        int min = INT8_MAX;
+        for (int i = 0; i < offsets.size(); i++) {
+            if (offsets[i].y < min) {
+                min = offsets[i].y;
+            }
+        }
+        minY = min;
+        return min;
+    }
+
+    int maxXOffset() {
+        if (maxX != 0) return maxX;
+        int max = INT8_MIN;
+        for (int i = 0; i < offsets.size(); i++) {
+            if (offsets[i].x > max) {
+                max = offsets[i].x;
+            }
+        }
+        maxX = max;
+        return max;
+    }
+
+    int maxYOffset() {
+        if (maxY != 0) return maxY;
+        int max = INT8_MIN;
+        for (int i = 0; i < offsets.size(); i++) {
+            if (offsets[i].y > max) {
+                max = offsets[i].y;
+            }
+        }
+        maxY = max;
+        return max;
+    }
+
+    WindowBounds bounds() {
+        WindowBounds b = {minXOffset(), minYOffset(), maxXOffset(), maxYOffset()};
+        return b;
+    }
+
+    int width() const {
+        int minx = INT8_MAX;
+        int maxx = INT8_MIN;
+        for (int i = 0; i < offsets.size(); i++) {
+            int x = offsets[i].x;
+            if (x < minx) {
+                minx = x;
+            }
+            if (x > maxx) {
+                maxx = x;
+            }
+        }
+        return (unsigned) maxx - minx;
+    }
+
+    int height() const {
+        int miny = INT8_MAX;
+        int maxy = INT8_MIN;
+        for (int i = 0; i < offsets.size(); i++) {
+            int y = offsets[i].y;
+            if (y < miny) {
+                miny = y;
+            }
+            if (y > maxy) {
+                maxy = y;
+            }
+        }
+        return maxy - miny;
+    }
+};
+
+#endif //C_IMPL_WINDOW_H
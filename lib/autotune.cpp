@@ -0,0 +1,189 @@
+#include "autotune.h"
+#include "program-cache.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdio.h>
+
+using std::string;
+using std::vector;
+
+static const int TUNING_RUNS = 3;
+
+cl::NDRange LaunchConfig::localRange(const unsigned dimensions) const {
+    if (local[0] == 0) {
+        return cl::NullRange;
+    }
+    if (dimensions == 1) {
+        return cl::NDRange(local[0]);
+    } else if (dimensions == 2) {
+        return cl::NDRange(local[0], local[1]);
+    }
+    return cl::NDRange(local[0], local[1], local[2]);
+}
+
+static size_t round_up(const size_t value, const size_t multiple) {
+    return multiple == 0 ? value : (value + multiple - 1) / multiple * multiple;
+}
+
+cl::NDRange LaunchConfig::globalRange(const size_t x, const size_t y, const size_t z) const {
+    if (z > 1 || local[2] > 1) {
+        return cl::NDRange(round_up(x, local[0]), round_up(y, local[1]), round_up(z, local[2]));
+    }
+    return cl::NDRange(round_up(x, local[0]), round_up(y, local[1]));
+}
+
+/* Clamps a work-group shape to the device, returning false if it cannot be launched at all */
+static bool fit_to_device(LaunchConfig &config, const vector<size_t> &item_limits, const size_t group_limit) {
+    if (config.local[0] == 0) {
+        // The driver's choice
+        config.local[1] = config.local[2] = 0;
+        return true;
+    }
+    size_t items = 1;
+    for (int i = 0; i < 3; i++) {
+        if (config.local[i] == 0) {
+            return false;
+        }
+        config.local[i] = std::min(config.local[i], i < (int) item_limits.size() ? item_limits[i] : (size_t) 1);
+        items *= config.local[i];
+    }
+    // Halve the largest dimension until the whole group fits
+    while (items > group_limit) {
+        size_t &largest = *std::max_element(config.local, config.local + 3);
+        items = items / largest * (largest / 2);
+        largest /= 2;
+    }
+    return items > 0;
+}
+
+bool TuningProfile::load(const string &path, const cl::Device &device) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+    const vector<size_t> item_limits = device.getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>();
+    const size_t group_limit = device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+    string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        string kernel;
+        LaunchConfig config;
+        if (fields >> kernel >> config.local[0] >> config.local[1] >> config.local[2] >> config.tile
+            && fit_to_device(config, item_limits, group_limit)) {
+            configs[kernel] = config;
+        }
+    }
+    return true;
+}
+
+bool TuningProfile::save(const string &path) const {
+    std::ofstream file(path);
+    for (auto &entry : configs) {
+        const LaunchConfig &config = entry.second;
+        file << entry.first << " " << config.local[0] << " " << config.local[1] << " " << config.local[2]
+             << " " << config.tile << std::endl;
+    }
+    return (bool) file;
+}
+
+LaunchConfig TuningProfile::get(const string &kernel, const LaunchConfig &fallback, const unsigned dimensions,
+                                const vector<size_t> &tiles) const {
+    auto stored = configs.find(kernel);
+    if (stored == configs.end() || std::find(tiles.begin(), tiles.end(), stored->second.tile) == tiles.end()) {
+        return fallback;
+    }
+    // The kernels skip items past the image only in the dimensions they are tuned over, so a group may
+    // not be rounded up in the others
+    LaunchConfig config = stored->second;
+    for (unsigned i = dimensions; i < 3 && config.local[0] != 0; i++) {
+        config.local[i] = 1;
+    }
+    return config;
+}
+
+void TuningProfile::set(const string &kernel, const LaunchConfig &config) {
+    configs[kernel] = config;
+}
+
+string tuning_profile_path(const cl::Device &device) {
+    const string directory = default_cache_directory();
+    if (directory.empty()) {
+        return "";
+    }
+    // Same FNV-1a as the program cache, over the fields that identify the device and its compiler
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : device.getInfo<CL_DEVICE_NAME>() + '\0' + device.getInfo<CL_DRIVER_VERSION>()) {
+        hash = (hash ^ c) * 1099511628211ULL;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.tune", (unsigned long long) hash);
+    return directory + "/" + name;
+}
+
+vector<LaunchConfig> launch_candidates(const cl::Kernel &kernel, const cl::Device &device,
+                                       const unsigned dimensions, const vector<size_t> &tiles) {
+    static const size_t shapes[][2] = {{0, 0}, {16, 1}, {32, 1}, {64, 1}, {128, 1}, {256, 1}, {8, 4}, {8, 8},
+                                       {16, 4}, {16, 8}, {16, 16}, {32, 4}, {32, 8}, {64, 4}};
+    const size_t kernel_limit = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+    const vector<size_t> item_limits = device.getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>();
+
+    vector<LaunchConfig> candidates;
+    for (auto &shape : shapes) {
+        const size_t x = shape[0], y = dimensions > 1 ? shape[1] : 1;
+        if (dimensions == 1 && shape[1] > 1) {
+            continue;
+        }
+        if (x != 0 && (x * y > kernel_limit || x > item_limits[0] || y > item_limits[1])) {
+            continue;
+        }
+        for (size_t tile : tiles) {
+            LaunchConfig config = {{x, x == 0 ? 0 : y, x == 0 ? 0 : (size_t) 1}, tile};
+            candidates.push_back(config);
+        }
+    }
+    return candidates;
+}
+
+/* Kernel time of a run, the sum of its events so gaps between launches are not counted */
+static double run_time(const vector<cl::Event> &events) {
+    double time = 0;
+    for (const cl::Event &event : events) {
+        time += (event.getProfilingInfo<CL_PROFILING_COMMAND_END>()
+                 - event.getProfilingInfo<CL_PROFILING_COMMAND_START>()) / 1e9;
+    }
+    return time;
+}
+
+LaunchConfig tune_kernel(cl::CommandQueue &queue, const string &name, const vector<LaunchConfig> &candidates,
+                         const KernelLaunch &launch) {
+    LaunchConfig best = candidates[0];
+    double best_time = std::numeric_limits<double>::max();
+    for (const LaunchConfig &config : candidates) {
+        double time = std::numeric_limits<double>::max();
+        try {
+            for (int run = 0; run < TUNING_RUNS; run++) {
+                vector<cl::Event> events = launch(config);
+                cl::Event::waitForEvents(events);
+                time = std::min(time, run_time(events));
+            }
+        } catch (const cl::Error &e) {
+            std::cout << name << " (" << config.local[0] << ", " << config.local[1] << ") tile " << config.tile
+                      << " rejected: " << e.what() << " " << e.err() << std::endl;
+            queue.finish();
+            continue;
+        }
+        std::cout << name << " (" << config.local[0] << ", " << config.local[1] << ") tile " << config.tile
+                  << ": " << time << std::endl;
+        if (time < best_time) {
+            best_time = time;
+            best = config;
+        }
+    }
+    std::cout << "Tuned " << name << " to (" << best.local[0] << ", " << best.local[1] << ") tile " << best.tile
+              << std::endl;
+    return best;
+}
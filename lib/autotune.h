@@ -0,0 +1,70 @@
+#ifndef LIB_AUTOTUNE_H
+#define LIB_AUTOTUNE_H
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#define __CL_ENABLE_EXCEPTIONS
+
+#include <CL/cl.hpp>
+
+/* How one kernel is launched: its work-group shape, where 0 leaves the shape to the driver, and a
+ * kernel specific tile size, such as the pixels each calculate_zncc work item scores
+ */
+struct LaunchConfig {
+    size_t local[3];
+    size_t tile;
+
+    /* Work-group size, or NullRange if it is left to the driver */
+    cl::NDRange localRange(unsigned dimensions) const;
+
+    /* Global size rounded up to whole work groups, the kernels skip the items past the image */
+    cl::NDRange globalRange(size_t x, size_t y, size_t z = 1) const;
+};
+
+/* Best launch configuration of each kernel on one device, stored as a small text file */
+class TuningProfile {
+private:
+    std::map<std::string, LaunchConfig> configs;
+
+public:
+    /* Returns false if there is no readable profile at path. Work-group sizes are clamped to what the
+     * device allows, and malformed entries are skipped.
+     */
+    bool load(const std::string &path, const cl::Device &device);
+
+    bool save(const std::string &path) const;
+
+    /* Stored configuration of a kernel, or fallback if there is none or its tile size is not one of
+     * tiles, the sizes the kernel is tuned over. The work group is flattened to the dimensions the
+     * kernel is tuned in, as for launch_candidates().
+     */
+    LaunchConfig get(const std::string &kernel, const LaunchConfig &fallback, unsigned dimensions,
+                     const std::vector<size_t> &tiles = {0}) const;
+
+    void set(const std::string &kernel, const LaunchConfig &config);
+};
+
+/* Profile file of the device in the program cache directory, keyed by device name and driver version */
+std::string tuning_profile_path(const cl::Device &device);
+
+/* Work-group shapes worth trying for a kernel of the given dimensionality, each combined with every
+ * tile size. Shapes the kernel or device cannot run are left out, and the driver's choice is always
+ * included.
+ */
+std::vector<LaunchConfig> launch_candidates(const cl::Kernel &kernel, const cl::Device &device,
+                                            unsigned dimensions, const std::vector<size_t> &tiles = {0});
+
+/* Enqueues one complete run of a kernel with the given configuration, returning its events */
+typedef std::function<std::vector<cl::Event>(const LaunchConfig &)> KernelLaunch;
+
+/* Times every candidate with the queue's profiling events and returns the fastest. Each one is run
+ * a few times and its best run counts, and candidates the device rejects are skipped. The kernels
+ * must give the same result every time they are run with the same arguments.
+ */
+LaunchConfig tune_kernel(cl::CommandQueue &queue, const std::string &name,
+                         const std::vector<LaunchConfig> &candidates, const KernelLaunch &launch);
+
+#endif //LIB_AUTOTUNE_H
@@ -0,0 +1,112 @@
+#include "memory-plan.h"
+
+#include <algorithm>
+#include <numeric>
+
+using std::string;
+using std::vector;
+
+MemoryPlan::MemoryPlan(size_t alignment) : alignment(std::max(alignment, (size_t) 1)) {}
+
+bool MemoryPlan::overlaps(const Entry &a, const Entry &b) const {
+    return a.first <= b.last && b.first <= a.last;
+}
+
+int MemoryPlan::add(const string &name, size_t bytes, int first, int last) {
+    entries.push_back({name, bytes, first, last, true, 0});
+    return (int) entries.size() - 1;
+}
+
+void MemoryPlan::addExternal(const string &name, size_t bytes, int first, int last) {
+    entries.push_back({name, bytes, first, last, false, 0});
+}
+
+void MemoryPlan::allocate(const cl::Context &ctx, size_t max_allocation) {
+    // Largest first, each at the lowest offset that does not collide with a buffer placed before it
+    // whose lifetime overlaps its own
+    vector<size_t> order(entries.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        return entries[a].bytes > entries[b].bytes;
+    });
+
+    vector<size_t> done;
+    arena_size = 0;
+    for (size_t i : order) {
+        Entry &entry = entries[i];
+        if (!entry.placed) {
+            continue;
+        }
+        size_t offset = 0;
+        for (bool moved = true; moved;) {
+            moved = false;
+            for (size_t j : done) {
+                const Entry &other = entries[j];
+                if (overlaps(entry, other) && offset < other.offset + other.bytes
+                    && other.offset < offset + entry.bytes) {
+                    offset = (other.offset + other.bytes + alignment - 1) / alignment * alignment;
+                    moved = true;
+                }
+            }
+        }
+        entry.offset = offset;
+        arena_size = std::max(arena_size, offset + entry.bytes);
+        done.push_back(i);
+    }
+
+    buffers.assign(entries.size(), cl::Buffer());
+    if (arena_size > max_allocation) {
+        arena_size = 0;
+        for (size_t i : done) {
+            entries[i].offset = arena_size;
+            arena_size += entries[i].bytes;
+            buffers[i] = cl::Buffer(ctx, CL_MEM_READ_WRITE, entries[i].bytes);
+        }
+        return;
+    }
+    if (arena_size == 0) {
+        return;
+    }
+    arena = cl::Buffer(ctx, CL_MEM_READ_WRITE, arena_size);
+    for (size_t i : done) {
+        cl_buffer_region region = {entries[i].offset, entries[i].bytes};
+        buffers[i] = arena.createSubBuffer(CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION, &region);
+    }
+}
+
+cl::Buffer MemoryPlan::get(int handle) const {
+    return buffers[handle];
+}
+
+size_t MemoryPlan::peakBytes() const {
+    int last_stage = 0;
+    for (const Entry &entry : entries) {
+        last_stage = std::max(last_stage, entry.last);
+    }
+    size_t peak = 0;
+    for (int stage = 0; stage <= last_stage; stage++) {
+        size_t external = 0;
+        for (const Entry &entry : entries) {
+            if (!entry.placed && entry.first <= stage && stage <= entry.last) {
+                external += entry.bytes;
+            }
+        }
+        peak = std::max(peak, external);
+    }
+    // The buffers are a single allocation that lives for the whole run
+    return peak + arena_size;
+}
+
+void MemoryPlan::report(std::ostream &out) const {
+    size_t unaliased = 0;
+    for (const Entry &entry : entries) {
+        out << entry.name << ": " << entry.bytes / 1024 << " KB, stages " << entry.first << "-" << entry.last;
+        if (entry.placed) {
+            out << " at offset " << entry.offset / 1024 << " KB";
+            unaliased += entry.bytes;
+        }
+        out << std::endl;
+    }
+    out << "Buffers take " << arena_size / 1024 << " KB instead of " << unaliased / 1024 << " KB" << std::endl
+        << "Peak device memory " << peakBytes() / 1024 << " KB" << std::endl;
+}
@@ -0,0 +1,62 @@
+#ifndef LIB_MEMORY_PLAN_H
+#define LIB_MEMORY_PLAN_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#define __CL_ENABLE_EXCEPTIONS
+
+#include <CL/cl.hpp>
+
+/* Lays out device buffers whose lifetimes are known in advance. Lifetimes are given as the first and
+ * last pipeline stage a buffer is used in. All buffers are placed in one allocation, and buffers that
+ * are never alive in the same stage share storage. Objects that cannot be placed in a buffer, such as
+ * images, can be registered so that the reported peak includes them.
+ */
+class MemoryPlan {
+private:
+    struct Entry {
+        std::string name;
+        size_t bytes;
+        int first, last;
+        bool placed;
+        size_t offset;
+    };
+
+    std::vector<Entry> entries;
+    size_t alignment;
+    size_t arena_size = 0;
+    cl::Buffer arena;
+    std::vector<cl::Buffer> buffers;
+
+    bool overlaps(const Entry &a, const Entry &b) const;
+
+public:
+    /* Buffers start on multiples of alignment, which must be at least the device's base address
+     * alignment for sub-buffers
+     */
+    explicit MemoryPlan(size_t alignment);
+
+    /* Adds a buffer used from stage first to stage last, inclusive. Returns the handle for get(). */
+    int add(const std::string &name, size_t bytes, int first, int last);
+
+    /* Counts an object allocated elsewhere in the peak */
+    void addExternal(const std::string &name, size_t bytes, int first, int last);
+
+    /* Places the buffers and allocates their storage. If the shared allocation would be larger than
+     * max_allocation, every buffer gets its own and nothing is aliased. Errors are thrown as cl::Error.
+     */
+    void allocate(const cl::Context &ctx, size_t max_allocation);
+
+    /* Buffer of an added entry, valid after allocate() */
+    cl::Buffer get(int handle) const;
+
+    /* Most device memory in use at any one stage, with every buffer alive for the whole stage */
+    size_t peakBytes() const;
+
+    /* Prints where each buffer was placed, the peak and what it would have been without aliasing */
+    void report(std::ostream &out) const;
+};
+
+#endif //LIB_MEMORY_PLAN_H
@@ -3,7 +3,11 @@
 //
 #include "opencl-helpers.h"
 #include "lodepng.h"
+#include "png-stream.h"
 
+#include <chrono>
+#include <iostream>
+#include <string.h>
 #include <string>
 #include <vector>
 
@@ -11,26 +15,115 @@ using std::string;
 using std::vector;
 
 
+/* Encodes mapped rows, which the encoder takes tightly packed with 16-bit samples in big endian order */
+static void encode_rows(const string &filename, const unsigned char *pixels, ::size_t row_pitch, unsigned w,
+                        unsigned h, LodePNGColorType color, unsigned bitdepth) {
+    const ::size_t row_bytes = w * (color == LCT_GREY ? 1 : 4) * bitdepth / 8;
+    if (row_pitch == row_bytes && bitdepth == 8) {
+        lodepng::encode(filename.c_str(), pixels, w, h, color, bitdepth);
+        return;
+    }
+    vector<uint8_t> output(row_bytes * h);
+    for (unsigned y = 0; y < h; y++) {
+        memcpy(&output[y * row_bytes], pixels + y * row_pitch, row_bytes);
+        for (::size_t i = 0; bitdepth == 16 && i < row_bytes; i += 2) {
+            uint16_t sample;
+            memcpy(&sample, &output[y * row_bytes + i], 2);
+            output[y * row_bytes + i] = (uint8_t) (sample >> 8);
+            output[y * row_bytes + i + 1] = (uint8_t) sample;
+        }
+    }
+    lodepng::encode(filename.c_str(), output, w, h, color, bitdepth);
+}
+
 void save_image_to_disk(const string &filename, cl::CommandQueue &queue, cl::Image2D &image,
                         const cl::size_t<3> &start, const cl::size_t<3> &end) {
     unsigned w = end[0] - start[0], h = end[1] - start[1];
-    vector<uint8_t > output = vector<uint8_t >(w*h*4);
-    queue.enqueueReadImage(image, CL_TRUE, start, end, 0, 0, &output[0], NULL, NULL);
-    lodepng::encode(filename.c_str(), output, w, h);
+    // Single channel images are written as greyscale, so the pixels never need expanding to RGBA
+    const cl_image_format format = image.getImageInfo<CL_IMAGE_FORMAT>();
+    ::size_t row_pitch;
+    unsigned char *pixels = (unsigned char *) queue.enqueueMapImage(image, CL_TRUE, CL_MAP_READ, start, end,
+                                                                    &row_pitch, NULL);
+    encode_rows(filename, pixels, row_pitch, w, h, format.image_channel_order == CL_R ? LCT_GREY : LCT_RGBA,
+                format.image_channel_data_type == CL_UNSIGNED_INT16 ? 16 : 8);
+    cl::Event unmapped;
+    queue.enqueueUnmapMemObject(image, pixels, NULL, &unmapped);
+    unmapped.wait();
 }
 
-void decode(const char *filename, unsigned &width, unsigned &height, std::vector<unsigned char> &image) {
-    lodepng::decode(image, width, height, filename);
+void save_buffer_to_disk(const string &filename, cl::CommandQueue &queue, cl::Buffer &buffer, unsigned width,
+                         unsigned height, ::size_t pitch, ::size_t element_size) {
+    unsigned char *pixels = (unsigned char *) queue.enqueueMapBuffer(buffer, CL_TRUE, CL_MAP_READ, 0,
+                                                                     height * pitch * element_size);
+    encode_rows(filename, pixels, pitch * element_size, width, height, LCT_GREY, element_size * 8);
+    cl::Event unmapped;
+    queue.enqueueUnmapMemObject(buffer, pixels, NULL, &unmapped);
+    unmapped.wait();
 }
 
-Image load_image(const char *filename) {
-    unsigned original_width, original_height;
-    vector<unsigned char> image = vector<unsigned char>();
-    decode(filename, original_width, original_height, image);
-    Image img;
-    img.height = original_height;
-    img.width = original_width;
-    img.pixels = image;
+DeviceImage load_image(const char *filename, const std::shared_future<DeviceQueue> &device, unsigned row_step) {
+    DeviceImage img = {};
+    PngRowDecoder decoder;
+    unsigned error = decoder.open(filename);
+    if (!error) {
+        const ::size_t width = decoder.width(), height = decoder.height() / row_step;
+        if (height == 0) {
+            std::cerr << filename << " has fewer than " << row_step << " rows" << std::endl;
+            return img;
+        }
+        cl::CommandQueue queue;
+        unsigned char *pixels = NULL;
+        ::size_t row_pitch = 0;
+        vector<unsigned char> early_rows;
+        auto map_image = [&]() {
+            const DeviceQueue &target = device.get();
+            queue = target.queue;
+            img.image = cl::Image2D(target.ctx, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR,
+                                    cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT8), width, height);
+            cl::size_t<3> origin, region;
+            origin[0] = origin[1] = origin[2] = 0;
+            region[0] = width;
+            region[1] = height;
+            region[2] = 1;
+            pixels = (unsigned char *) queue.enqueueMapImage(
+                    img.image, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION, origin, region, &row_pitch, NULL);
+            for (::size_t y = 0; y * width * 4 < early_rows.size(); y++) {
+                memcpy(pixels + y * row_pitch, &early_rows[y * width * 4], width * 4);
+            }
+            vector<unsigned char>().swap(early_rows);
+        };
+        // A failed setup is not thrown through the decoder, but again once the rows are done
+        bool setup_failed = false;
+        error = decoder.decodeRows(row_step, [&](unsigned y, const unsigned char *rgba) {
+            if (y / row_step >= height) {
+                return;
+            }
+            if (!pixels && !setup_failed && device.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                try {
+                    map_image();
+                } catch (const cl::Error &) {
+                    setup_failed = true;
+                }
+            }
+            if (pixels) {
+                memcpy(pixels + y / row_step * row_pitch, rgba, width * 4);
+            } else {
+                early_rows.insert(early_rows.end(), rgba, rgba + width * 4);
+            }
+        });
+        if (!error && !pixels) {
+            map_image();
+        }
+        if (pixels) {
+            cl::Event unmapped;
+            queue.enqueueUnmapMemObject(img.image, pixels, NULL, &unmapped);
+            unmapped.wait();
+        }
+        if (!error) {
+            img.width = width;
+            img.height = height;
+        }
+    }
+    if (error) std::cerr << "decoder error " << error << ": " << lodepng_error_text(error) << std::endl;
     return img;
 }
-
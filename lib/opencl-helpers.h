@@ -5,6 +5,7 @@
 #ifndef LIB_OPENCL_HELPERS_H
 #define LIB_OPENCL_HELPERS_H
 
+#include <future>
 #include <string>
 #include <vector>
 
@@ -15,7 +16,34 @@ struct Image {
     std::vector<unsigned char> pixels;
 };
 
+/* RGBA image decoded straight into memory that the device can use */
+struct DeviceImage {
+    cl::Image2D image;
+    ::size_t height, width;
+};
+
+/* The context and queue that images are loaded for */
+struct DeviceQueue {
+    cl::Context ctx;
+    cl::CommandQueue queue;
+};
+
+/* Encodes a region of an RGBA or single channel (CL_R) 8 or 16-bit image as PNG. The image is mapped
+ * instead of copied out, so one allocated with CL_MEM_ALLOC_HOST_PTR is read in place on devices that
+ * share memory with the host.
+ */
 void save_image_to_disk(const std::string &filename, cl::CommandQueue &queue, cl::Image2D &image, const cl::size_t<3> &start, const cl::size_t<3> &end);
-Image load_image(const char *filename);
+/* Encodes a pitched buffer of 8 or 16-bit values as a greyscale PNG, pitch being given in elements */
+void save_buffer_to_disk(const std::string &filename, cl::CommandQueue &queue, cl::Buffer &buffer, unsigned width,
+                         unsigned height, ::size_t pitch, ::size_t element_size);
+/* Loads an RGBA image, keeping only every row_step-th row. The rows that are dropped are never
+ * converted or stored, so a caller that downsamples vertically does not pay for them.
+ * The image is allocated by the driver with CL_MEM_ALLOC_HOST_PTR and the decoder writes its rows
+ * through a mapping of it, so there is no host copy to upload. Decoding starts before the device is
+ * set up: rows that arrive earlier are kept on the host until the image can be mapped. Returns an
+ * empty image on decoder errors and rethrows the cl::Error of a failed setup.
+ */
+DeviceImage load_image(const char *filename, const std::shared_future<DeviceQueue> &device,
+                       unsigned row_step = 1);
 
 #endif //LIB_OPENCL_HELPERS_H
@@ -0,0 +1,579 @@
+#include "png-stream.h"
+
+#include <cstdint>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+using std::vector;
+
+static const unsigned WINDOW_SIZE = 32768;
+static const int FAST_BITS = 9;
+// Most literal/length and distance codes a dynamic block may define
+static const unsigned MAX_LITERAL_CODES = 286;
+static const unsigned MAX_DISTANCE_CODES = 30;
+
+static const unsigned short LENGTH_BASE[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51,
+                                               59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const unsigned char LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4,
+                                               5, 5, 5, 5, 0};
+static const unsigned short DISTANCE_BASE[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+                                                 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385,
+                                                 24577};
+static const unsigned char DISTANCE_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10,
+                                                 10, 11, 11, 12, 12, 13, 13};
+static const unsigned char CODE_LENGTH_ORDER[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+/* Canonical Huffman code. Codes of up to FAST_BITS bits are resolved with a single table lookup on
+ * the bit-reversed input, longer ones by comparing against the largest code of each length.
+ */
+struct Huffman {
+    uint16_t fast[1 << FAST_BITS];
+    uint16_t first_code[16];
+    uint16_t first_symbol[16];
+    int max_code[17];
+    uint8_t size[288];
+    uint16_t value[288];
+};
+
+static int bit_reverse(int v, const int bits) {
+    v = ((v & 0xAAAA) >> 1) | ((v & 0x5555) << 1);
+    v = ((v & 0xCCCC) >> 2) | ((v & 0x3333) << 2);
+    v = ((v & 0xF0F0) >> 4) | ((v & 0x0F0F) << 4);
+    v = ((v & 0xFF00) >> 8) | ((v & 0x00FF) << 8);
+    return v >> (16 - bits);
+}
+
+static unsigned build_huffman(Huffman &huffman, const unsigned char *lengths, const unsigned count) {
+    int sizes[17] = {0};
+    int next_code[16];
+    memset(huffman.fast, 0, sizeof(huffman.fast));
+    for (unsigned i = 0; i < count; i++) {
+        sizes[lengths[i]]++;
+    }
+    sizes[0] = 0;
+
+    int code = 0, symbol = 0;
+    for (int i = 1; i < 16; i++) {
+        next_code[i] = code;
+        huffman.first_code[i] = (uint16_t) code;
+        huffman.first_symbol[i] = (uint16_t) symbol;
+        code += sizes[i];
+        if (sizes[i] && code - 1 >= (1 << i)) {
+            return 55; // more codes of this length than fit, the tree is oversubscribed
+        }
+        huffman.max_code[i] = code << (16 - i);
+        code <<= 1;
+        symbol += sizes[i];
+    }
+    huffman.max_code[16] = 0x10000;
+
+    for (unsigned i = 0; i < count; i++) {
+        const int s = lengths[i];
+        if (s == 0) {
+            continue;
+        }
+        const int c = next_code[s] - huffman.first_code[s] + huffman.first_symbol[s];
+        huffman.size[c] = (uint8_t) s;
+        huffman.value[c] = (uint16_t) i;
+        if (s <= FAST_BITS) {
+            for (int j = bit_reverse(next_code[s], s); j < (1 << FAST_BITS); j += 1 << s) {
+                huffman.fast[j] = (uint16_t) ((s << 9) | i);
+            }
+        }
+        next_code[s]++;
+    }
+    return 0;
+}
+
+static bool valid_color(const LodePNGColorType type, const unsigned bitdepth) {
+    switch (type) {
+        case LCT_GREY:
+            return bitdepth == 1 || bitdepth == 2 || bitdepth == 4 || bitdepth == 8 || bitdepth == 16;
+        case LCT_PALETTE:
+            return bitdepth == 1 || bitdepth == 2 || bitdepth == 4 || bitdepth == 8;
+        case LCT_RGB:
+        case LCT_GREY_ALPHA:
+        case LCT_RGBA:
+            return bitdepth == 8 || bitdepth == 16;
+        default:
+            return false;
+    }
+}
+
+/* Reads one whole chunk (length, type, data and CRC) and checks its CRC */
+static unsigned read_chunk(FILE *file, vector<unsigned char> &chunk) {
+    chunk.resize(8);
+    if (fread(&chunk[0], 1, 8, file) != 8) {
+        return 30;
+    }
+    const unsigned length = lodepng_chunk_length(&chunk[0]);
+    if (length > 2147483647u) {
+        return 63;
+    }
+    chunk.resize(12 + length);
+    if (fread(&chunk[8], 1, length + 4, file) != length + 4) {
+        return 30;
+    }
+    return lodepng_chunk_check_crc(&chunk[0]) ? 57 : 0;
+}
+
+/* Inflates the zlib stream spread over the IDAT chunks and reassembles scanlines from its output */
+class RowInflater {
+private:
+    FILE *file;
+    vector<unsigned char> &chunk;
+    size_t input_pos, input_end;
+    bool data_ended = false;
+
+    uint32_t bit_buffer = 0;
+    int bit_count = 0;
+    // Zero bytes appended to the bit buffer after the last IDAT chunk ran out
+    int padding = 0;
+
+    vector<unsigned char> window;
+    size_t output_count = 0;
+    uint32_t adler_a = 1, adler_b = 0;
+    unsigned adler_pending = 0;
+
+    const LodePNGColorMode &color;
+    LodePNGColorMode rgba_mode;
+    unsigned width, height, step;
+    const RowCallback &callback;
+    size_t line_bytes, line_pos = 0;
+    unsigned bytes_per_pixel, row = 0;
+    vector<unsigned char> scanline, previous, rgba;
+    unsigned error = 0;
+
+    int nextByte() {
+        while (input_pos == input_end) {
+            if (data_ended) {
+                return -1;
+            }
+            unsigned chunk_error = read_chunk(file, chunk);
+            if (chunk_error || !lodepng_chunk_type_equals(&chunk[0], "IDAT")) {
+                // The image data is over; whatever chunk follows is not needed for the pixels
+                data_ended = true;
+                if (chunk_error) {
+                    error = chunk_error;
+                }
+                return -1;
+            }
+            input_pos = 8;
+            input_end = 8 + lodepng_chunk_length(&chunk[0]);
+        }
+        return chunk[input_pos++];
+    }
+
+    void fill() {
+        while (bit_count <= 24) {
+            int byte = nextByte();
+            if (byte < 0) {
+                byte = 0;
+                padding++;
+            }
+            bit_buffer |= (uint32_t) byte << bit_count;
+            bit_count += 8;
+        }
+    }
+
+    // True once bits beyond the end of the image data have been consumed
+    bool overrun() const {
+        return padding * 8 > bit_count;
+    }
+
+    void consume(const int count) {
+        bit_buffer >>= count;
+        bit_count -= count;
+    }
+
+    unsigned bits(const int count) {
+        if (count == 0) {
+            return 0;
+        }
+        if (bit_count < count) {
+            fill();
+        }
+        const unsigned value = bit_buffer & ((1u << count) - 1);
+        consume(count);
+        return value;
+    }
+
+    int decode(const Huffman &huffman) {
+        if (bit_count < 16) {
+            fill();
+        }
+        const int entry = huffman.fast[bit_buffer & ((1 << FAST_BITS) - 1)];
+        if (entry) {
+            consume(entry >> 9);
+            return entry & 511;
+        }
+        const int k = bit_reverse(bit_buffer & 0xFFFF, 16);
+        int s = FAST_BITS + 1;
+        while (k >= huffman.max_code[s]) {
+            s++;
+        }
+        if (s >= 16) {
+            return -1;
+        }
+        const int index = (k >> (16 - s)) - huffman.first_code[s] + huffman.first_symbol[s];
+        if (index >= 288 || huffman.size[index] != s) {
+            return -1;
+        }
+        consume(s);
+        return huffman.value[index];
+    }
+
+    void emit(const unsigned char byte) {
+        window[output_count & (WINDOW_SIZE - 1)] = byte;
+        output_count++;
+
+        adler_a += byte;
+        adler_b += adler_a;
+        // 5552 is the most bytes that can be summed before the 32-bit sums may overflow
+        if (++adler_pending == 5552) {
+            adler_a %= 65521;
+            adler_b %= 65521;
+            adler_pending = 0;
+        }
+
+        if (row == height) {
+            error = 91;
+            return;
+        }
+        scanline[line_pos++] = byte;
+        if (line_pos == line_bytes) {
+            finishScanline();
+        }
+    }
+
+    void finishScanline() {
+        unsigned char *current = &scanline[1];
+        const unsigned char *above = &previous[1];
+        const size_t length = line_bytes - 1;
+        const unsigned bw = bytes_per_pixel;
+        switch (scanline[0]) {
+            case 0:
+                break;
+            case 1:
+                for (size_t i = bw; i < length; i++) {
+                    current[i] += current[i - bw];
+                }
+                break;
+            case 2:
+                for (size_t i = 0; i < length; i++) {
+                    current[i] += above[i];
+                }
+                break;
+            case 3:
+                for (size_t i = 0; i < bw && i < length; i++) {
+                    current[i] += above[i] >> 1;
+                }
+                for (size_t i = bw; i < length; i++) {
+                    current[i] += (current[i - bw] + above[i]) >> 1;
+                }
+                break;
+            case 4:
+                for (size_t i = 0; i < bw && i < length; i++) {
+                    current[i] += above[i];
+                }
+                for (size_t i = bw; i < length; i++) {
+                    const int a = current[i - bw], b = above[i], c = above[i - bw];
+                    const int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+                    current[i] += (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+                }
+                break;
+            default:
+                error = 36;
+                return;
+        }
+
+        if (row % step == 0) {
+            unsigned convert_error = lodepng_convert(&rgba[0], current, &rgba_mode, &color, width, 1);
+            if (convert_error) {
+                error = convert_error;
+                return;
+            }
+            callback(row, &rgba[0]);
+        }
+        scanline.swap(previous);
+        line_pos = 0;
+        row++;
+    }
+
+    unsigned inflateBlock(const Huffman &literals, const Huffman &distances) {
+        while (!error) {
+            const int symbol = decode(literals);
+            if (symbol < 0) {
+                return 11;
+            }
+            if (overrun()) {
+                return 10;
+            }
+            if (symbol < 256) {
+                emit((unsigned char) symbol);
+            } else if (symbol == 256) {
+                return 0;
+            } else {
+                const int length_code = symbol - 257;
+                if (length_code >= 29) {
+                    return 16;
+                }
+                const unsigned length = LENGTH_BASE[length_code] + bits(LENGTH_EXTRA[length_code]);
+                const int distance_code = decode(distances);
+                if (distance_code < 0 || distance_code >= 30) {
+                    return 18;
+                }
+                const unsigned distance = DISTANCE_BASE[distance_code] + bits(DISTANCE_EXTRA[distance_code]);
+                if (overrun()) {
+                    return 10;
+                }
+                // The largest distance is exactly the window size, so only the start of the stream can
+                // be referenced beyond what was written
+                if (distance > output_count) {
+                    return 52;
+                }
+                for (unsigned i = 0; i < length && !error; i++) {
+                    emit(window[(output_count - distance) & (WINDOW_SIZE - 1)]);
+                }
+            }
+        }
+        return error;
+    }
+
+    unsigned readDynamicTrees(Huffman &literals, Huffman &distances) {
+        const unsigned literal_count = bits(5) + 257, distance_count = bits(5) + 1, length_count = bits(4) + 4;
+        // The 5-bit counts can name codes 286 and 287 and distances 30 and 31, which do not exist
+        if (literal_count > MAX_LITERAL_CODES || distance_count > MAX_DISTANCE_CODES) {
+            return 13;
+        }
+        unsigned char code_lengths[19] = {0};
+        for (unsigned i = 0; i < length_count; i++) {
+            code_lengths[CODE_LENGTH_ORDER[i]] = (unsigned char) bits(3);
+        }
+        if (overrun()) {
+            return 50;
+        }
+        Huffman code_length_tree;
+        unsigned tree_error = build_huffman(code_length_tree, code_lengths, 19);
+        if (tree_error) {
+            return tree_error;
+        }
+
+        unsigned char lengths[MAX_LITERAL_CODES + MAX_DISTANCE_CODES];
+        unsigned n = 0;
+        while (n < literal_count + distance_count) {
+            const int symbol = decode(code_length_tree);
+            if (symbol < 0 || overrun()) {
+                return 16;
+            }
+            if (symbol < 16) {
+                lengths[n++] = (unsigned char) symbol;
+                continue;
+            }
+            unsigned char value = 0;
+            unsigned repeat;
+            if (symbol == 16) {
+                if (n == 0) {
+                    return 54;
+                }
+                value = lengths[n - 1];
+                repeat = 3 + bits(2);
+            } else if (symbol == 17) {
+                repeat = 3 + bits(3);
+            } else {
+                repeat = 11 + bits(7);
+            }
+            if (n + repeat > literal_count + distance_count) {
+                return 13;
+            }
+            memset(lengths + n, value, repeat);
+            n += repeat;
+        }
+        if (lengths[256] == 0) {
+            return 64;
+        }
+        tree_error = build_huffman(literals, lengths, literal_count);
+        if (!tree_error) {
+            tree_error = build_huffman(distances, lengths + literal_count, distance_count);
+        }
+        return tree_error;
+    }
+
+public:
+    RowInflater(FILE *file, vector<unsigned char> &first_idat, const LodePNGColorMode &color, const unsigned width,
+                const unsigned height, const unsigned step, const RowCallback &callback)
+            : file(file), chunk(first_idat), input_pos(8), input_end(8 + lodepng_chunk_length(&first_idat[0])),
+              window(WINDOW_SIZE), color(color), width(width), height(height), step(step), callback(callback) {
+        lodepng_color_mode_init(&rgba_mode);
+        const unsigned bpp = lodepng_get_bpp(&color);
+        line_bytes = 1 + ((size_t) width * bpp + 7) / 8;
+        bytes_per_pixel = (bpp + 7) / 8;
+        scanline = vector<unsigned char>(line_bytes, 0);
+        previous = vector<unsigned char>(line_bytes, 0);
+        rgba = vector<unsigned char>((size_t) width * 4);
+    }
+
+    unsigned run() {
+        const unsigned cmf = bits(8), flg = bits(8);
+        if ((cmf * 256 + flg) % 31 != 0) {
+            return 24;
+        }
+        if ((cmf & 15) != 8 || (cmf >> 4) > 7) {
+            return 25;
+        }
+        if (flg & 32) {
+            return 26;
+        }
+
+        Huffman literals, distances;
+        bool final_block = false;
+        while (!final_block) {
+            final_block = bits(1) != 0;
+            const unsigned type = bits(2);
+            unsigned block_error = 0;
+            if (type == 0) {
+                consume(bit_count & 7);
+                const unsigned length = bits(16), complement = bits(16);
+                if (length + complement != 65535) {
+                    return 21;
+                }
+                for (unsigned i = 0; i < length && !error; i++) {
+                    emit((unsigned char) bits(8));
+                }
+                if (overrun()) {
+                    return 23;
+                }
+            } else if (type == 1) {
+                unsigned char lengths[288 + 32];
+                memset(lengths, 8, 144);
+                memset(lengths + 144, 9, 112);
+                memset(lengths + 256, 7, 24);
+                memset(lengths + 280, 8, 8);
+                memset(lengths + 288, 5, 32);
+                build_huffman(literals, lengths, 288);
+                build_huffman(distances, lengths + 288, 32);
+                block_error = inflateBlock(literals, distances);
+            } else if (type == 2) {
+                block_error = readDynamicTrees(literals, distances);
+                if (!block_error) {
+                    block_error = inflateBlock(literals, distances);
+                }
+            } else {
+                return 20;
+            }
+            if (block_error || error) {
+                return block_error ? block_error : error;
+            }
+        }
+
+        // The Adler-32 checksum of the inflated data follows at the next byte boundary
+        consume(bit_count & 7);
+        uint32_t adler = 0;
+        for (int i = 0; i < 4; i++) {
+            adler = (adler << 8) | bits(8);
+        }
+        if (overrun()) {
+            return 23;
+        }
+        if (adler != ((adler_b % 65521) << 16 | (adler_a % 65521))) {
+            return 58;
+        }
+        return row == height ? 0 : 91;
+    }
+};
+
+PngRowDecoder::~PngRowDecoder() {
+    if (file) {
+        fclose(file);
+    }
+}
+
+unsigned PngRowDecoder::open(const char *filename) {
+    path = filename;
+    file = fopen(filename, "rb");
+    if (!file) {
+        return 78;
+    }
+    // Signature and IHDR chunk
+    unsigned char header[33];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header)) {
+        return 27;
+    }
+    unsigned error = lodepng_inspect(&w, &h, &state, header, sizeof(header));
+    if (error) {
+        return error;
+    }
+    const LodePNGColorMode &color = state.info_png.color;
+    if (color.colortype != LCT_GREY && color.colortype != LCT_RGB && color.colortype != LCT_PALETTE
+        && color.colortype != LCT_GREY_ALPHA && color.colortype != LCT_RGBA) {
+        return 31;
+    }
+    return valid_color(color.colortype, color.bitdepth) ? 0 : 37;
+}
+
+unsigned PngRowDecoder::decodeRows(const unsigned step, const RowCallback &row) {
+    if (state.info_png.interlace_method != 0) {
+        // Adam7 passes do not produce whole rows in order
+        vector<unsigned char> image;
+        unsigned error = lodepng::decode(image, w, h, path);
+        for (unsigned y = 0; !error && y < h; y += step) {
+            row(y, &image[(size_t) y * w * 4]);
+        }
+        return error;
+    }
+
+    LodePNGColorMode &color = state.info_png.color;
+    vector<unsigned char> chunk;
+    while (true) {
+        unsigned error = read_chunk(file, chunk);
+        if (error) {
+            return error;
+        }
+        const unsigned length = lodepng_chunk_length(&chunk[0]);
+        const unsigned char *data = &chunk[8];
+        if (lodepng_chunk_type_equals(&chunk[0], "IDAT")) {
+            break;
+        } else if (lodepng_chunk_type_equals(&chunk[0], "IEND")) {
+            return 91;
+        } else if (lodepng_chunk_type_equals(&chunk[0], "PLTE")) {
+            if (length % 3 != 0 || length / 3 > 256) {
+                return 38;
+            }
+            lodepng_palette_clear(&color);
+            for (unsigned i = 0; i < length; i += 3) {
+                lodepng_palette_add(&color, data[i], data[i + 1], data[i + 2], 255);
+            }
+        } else if (lodepng_chunk_type_equals(&chunk[0], "tRNS")) {
+            if (color.colortype == LCT_PALETTE) {
+                if (length > color.palettesize) {
+                    return 39;
+                }
+                for (unsigned i = 0; i < length; i++) {
+                    color.palette[4 * i + 3] = data[i];
+                }
+            } else if (color.colortype == LCT_GREY) {
+                if (length != 2) {
+                    return 40;
+                }
+                color.key_defined = 1;
+                color.key_r = color.key_g = color.key_b = 256u * data[0] + data[1];
+            } else if (color.colortype == LCT_RGB) {
+                if (length != 6) {
+                    return 41;
+                }
+                color.key_defined = 1;
+                color.key_r = 256u * data[0] + data[1];
+                color.key_g = 256u * data[2] + data[3];
+                color.key_b = 256u * data[4] + data[5];
+            } else {
+                return 42;
+            }
+        } else if (!lodepng_chunk_ancillary(&chunk[0])) {
+            return 69;
+        }
+    }
+
+    RowInflater inflater(file, chunk, color, w, h, step > 0 ? step : 1, row);
+    return inflater.run();
+}
@@ -0,0 +1,44 @@
+#ifndef LIB_PNG_STREAM_H
+#define LIB_PNG_STREAM_H
+
+#include <cstdio>
+#include <functional>
+#include <string>
+
+#include "lodepng.h"
+
+/* Receives row y of an image as RGBA, 4 bytes per pixel */
+typedef std::function<void(unsigned y, const unsigned char *rgba)> RowCallback;
+
+/* Decodes a PNG file one scanline at a time. Chunks are read from disk only when they are needed.
+ * The image data is inflated through a 32 KiB window, and each scanline is unfiltered against the
+ * previous one and handed to a callback, so the full image is never held in memory. lodepng handles
+ * the header, the CRCs and the colour conversion, but its inflate only works from one buffer holding
+ * the whole zlib stream into another holding the whole output, so the inflater is our own. It rejects
+ * malformed streams, reporting them with lodepng's error codes.
+ * Interlaced images cannot be consumed row by row, so they are decoded whole with lodepng instead.
+ */
+class PngRowDecoder {
+private:
+    FILE *file = NULL;
+    std::string path;
+    lodepng::State state;
+    unsigned w = 0, h = 0;
+
+public:
+    ~PngRowDecoder();
+
+    /* Opens the file and reads the header. Returns a lodepng error code. */
+    unsigned open(const char *filename);
+
+    unsigned width() const { return w; }
+
+    unsigned height() const { return h; }
+
+    /* Decodes the image, passing every row whose index is a multiple of step to the callback.
+     * Returns a lodepng error code.
+     */
+    unsigned decodeRows(unsigned step, const RowCallback &row);
+};
+
+#endif //LIB_PNG_STREAM_H
@@ -0,0 +1,153 @@
+#include "program-cache.h"
+
+#include <errno.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <tuple>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+string KernelVariant::buildOptions() const {
+    std::ostringstream options;
+    options << "-D WINDOW_SIZE=" << window_size
+            << " -D MAX_DISP=" << ndisp
+            << " -D CC_THRESHOLD=" << threshold
+            << " -D PIXEL_T=" << pixel_type;
+    return options.str();
+}
+
+bool KernelVariant::operator<(const KernelVariant &other) const {
+    return std::tie(window_size, ndisp, threshold, pixel_type)
+           < std::tie(other.window_size, other.ndisp, other.threshold, other.pixel_type);
+}
+
+/* 64-bit FNV-1a, which unlike std::hash gives the same value across compilers and runs */
+static uint64_t fnv1a(const string &text, uint64_t hash = 14695981039346656037ULL) {
+    for (unsigned char c : text) {
+        hash = (hash ^ c) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* Creates the directory and its parents, succeeding if they already exist */
+static bool make_directories(const string &path) {
+    for (size_t i = 1; i <= path.size(); i++) {
+        if (i == path.size() || path[i] == '/') {
+            if (mkdir(path.substr(0, i).c_str(), 0755) != 0 && errno != EEXIST) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+ProgramCache::ProgramCache(const cl::Context &context, const string &source, const string &directory)
+        : context(context), source(source), directory(directory) {
+}
+
+string ProgramCache::binaryPath(const cl::Device &device, const string &options) const {
+    // The fields are separated by a character that cannot occur in them so that no two keys collide
+    const string key = device.getInfo<CL_DEVICE_NAME>() + '\0' + device.getInfo<CL_DRIVER_VERSION>() + '\0'
+                       + options + '\0' + source;
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long) fnv1a(key));
+    return directory + "/" + name;
+}
+
+bool ProgramCache::loadBinary(const cl::Device &device, const string &path, const string &options,
+                              cl::Program &program) const {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    const string binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (binary.empty()) {
+        return false;
+    }
+    try {
+        vector<cl_int> status;
+        const vector<cl::Device> devices(1, device);
+        program = cl::Program(context, devices,
+                              cl::Program::Binaries(1, std::make_pair(binary.data(), binary.size())), &status);
+        program.build(devices, options.c_str());
+    } catch (const cl::Error &) {
+        // Typically a binary left behind by another driver build, it gets replaced below
+        return false;
+    }
+    return true;
+}
+
+void ProgramCache::saveBinary(const cl::Program &program, const string &path) const {
+    size_t size = 0;
+    if (clGetProgramInfo(program(), CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, NULL) != CL_SUCCESS
+        || size == 0 || !make_directories(directory)) {
+        return;
+    }
+    vector<unsigned char> binary(size);
+    unsigned char *binaries[] = {&binary[0]};
+    if (clGetProgramInfo(program(), CL_PROGRAM_BINARIES, sizeof(binaries), binaries, NULL) != CL_SUCCESS) {
+        return;
+    }
+
+    // Written under a temporary name and renamed, so a concurrent run never reads a partial file
+    const string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary);
+        file.write((const char *) &binary[0], binary.size());
+        if (!file) {
+            remove(temporary.c_str());
+            return;
+        }
+    }
+    rename(temporary.c_str(), path.c_str());
+}
+
+cl::Program ProgramCache::get(const cl::Device &device, const KernelVariant &variant) {
+    const std::pair<cl_device_id, KernelVariant> key(device(), variant);
+    auto cached = programs.find(key);
+    if (cached != programs.end()) {
+        return cached->second;
+    }
+
+    const string options = variant.buildOptions();
+    const string path = directory.empty() ? "" : binaryPath(device, options);
+    cl::Program program;
+    if (path.empty() || !loadBinary(device, path, options, program)) {
+        program = cl::Program(context, cl::Program::Sources(1, std::make_pair(source.c_str(), source.size())));
+        try {
+            program.build(vector<cl::Device>(1, device), options.c_str());
+        } catch (const cl::Error &) {
+            std::cerr << "OpenCL compilation error with " << options << std::endl
+                      << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << std::endl;
+            throw;
+        }
+        if (!path.empty()) {
+            saveBinary(program, path);
+        }
+    }
+    programs[key] = program;
+    return program;
+}
+
+string default_cache_directory() {
+    const char *directory = getenv("OPENCL_NCC_CACHE");
+    if (directory) {
+        return directory;
+    }
+    directory = getenv("XDG_CACHE_HOME");
+    if (directory && *directory) {
+        return string(directory) + "/opencl-ncc";
+    }
+    directory = getenv("HOME");
+    if (directory && *directory) {
+        return string(directory) + "/.cache/opencl-ncc";
+    }
+    return "";
+}
@@ -0,0 +1,61 @@
+#ifndef LIB_PROGRAM_CACHE_H
+#define LIB_PROGRAM_CACHE_H
+
+#include <map>
+#include <string>
+
+#define __CL_ENABLE_EXCEPTIONS
+
+#include <CL/cl.hpp>
+
+/* Parameters that are compiled into the kernels as -D build options instead of being passed as
+ * kernel arguments, so the compiler sees the window loops as fixed-count and can unroll them.
+ */
+struct KernelVariant {
+    int window_size;
+    int ndisp;
+    int threshold;
+    // Element type of the greyscale buffers
+    std::string pixel_type;
+
+    std::string buildOptions() const;
+
+    bool operator<(const KernelVariant &other) const;
+};
+
+/* Builds the program once per device and kernel variant and hands out the built program on later
+ * requests, so switching parameters back and forth does not recompile.
+ * When a cache directory is given, built binaries are also stored there under a hash of the device
+ * name, driver version, source and build options, and later runs load them with
+ * clCreateProgramWithBinary instead of compiling. A binary the driver rejects is rebuilt from source.
+ */
+class ProgramCache {
+private:
+    cl::Context context;
+    std::string source;
+    std::string directory;
+    std::map<std::pair<cl_device_id, KernelVariant>, cl::Program> programs;
+
+    std::string binaryPath(const cl::Device &device, const std::string &options) const;
+
+    bool loadBinary(const cl::Device &device, const std::string &path, const std::string &options,
+                    cl::Program &program) const;
+
+    void saveBinary(const cl::Program &program, const std::string &path) const;
+
+public:
+    /* An empty directory keeps the cache in memory only */
+    ProgramCache(const cl::Context &context, const std::string &source, const std::string &directory = "");
+
+    /* Returns the program built for the device with the variant's options. Build failures print the
+     * build log and rethrow the cl::Error.
+     */
+    cl::Program get(const cl::Device &device, const KernelVariant &variant);
+};
+
+/* $OPENCL_NCC_CACHE if set, otherwise opencl-ncc under $XDG_CACHE_HOME or ~/.cache. Empty if none
+ * of these is available.
+ */
+std::string default_cache_directory();
+
+#endif //LIB_PROGRAM_CACHE_H
@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <future>
+#include <memory>
 #include <vector>
 #include <stdlib.h>
 
@@ -5,10 +8,13 @@
 
 #include <CL/cl.hpp>
 #include <iostream>
-#include <fstream>
 #include <sstream>
 #include "../lib/timing.h"
 #include "../lib/opencl-helpers.h"
+#include "../lib/program-cache.h"
+#include "../lib/autotune.h"
+#include "../lib/memory-plan.h"
+#include "kernels.h"
 
 using std::vector;
 using std::cout;
@@ -18,14 +24,22 @@ using std::endl;
 using std::string;
 
 //#define SAVE_INTERMEDIATE_STEPS
+// Compute each correlation once for both disparity maps instead of running calculate_zncc twice
+#define SYMMETRIC_ZNCC
+// Fill occlusions with the ring search of cross_check_fill instead of the exact distance transform
+//#define RING_FILL
 
 struct imageSet {
-    Image originalImage;
-    cl::Image2D original, meaned, znccd, for_mean;
-    cl::Buffer gs;
+    cl::Image2D original;
+    cl::Buffer gs, stats, znccd;
     string fileName;
 } left, right;
 
+// Pipeline stages, which give the lifetimes of the device buffers
+enum Stage {
+    PREPROCESS, ZNCC, POST_PROCESS
+};
+
 int getIntArg(char *arg, int defval) {
     istringstream ss(arg);
     int x;
@@ -48,52 +62,44 @@ double outputEventExecutionTime(const cl::Event &e) {
     }
 }
 
-int main(int argc, char *argv[]) {
-    Timer timer = Timer();
-    timer.start();
-
-    const char *left_name = argc > 1 ? argv[1] : "im0.png";
-    const char *right_name = argc > 2 ? argv[2] : "im1.png";
-    const int ndisp = argc > 3 ? getIntArg(argv[3], 70) : 70;
-    const int thresh = argc > 4 ? getIntArg(argv[4], 8) : 8;
-
-    left.fileName = "left.png";
-    right.fileName = "right.png";
-
-    timer.checkPoint("Load images from disk");
-    left.originalImage = load_image(left_name);
-    right.originalImage = load_image(right_name);
-    timer.checkPoint("Images loaded");
-
-    Image resizedImage = {};
-    resizedImage.width = left.originalImage.width / 4;
-    resizedImage.height = left.originalImage.height / 4;
-
+struct OpenCLSetup {
+    vector <cl::Device> devices;
+    cl::Context ctx;
+    cl::CommandQueue queue;
+    // Kept so that built variants stay available for the rest of the run
+    std::shared_ptr<ProgramCache> programs;
+};
+
+/* Picks the GPUs of the first platform and creates the context, the queue and the program cache.
+ * Errors are thrown as cl::Error.
+ */
+OpenCLSetup setup_opencl() {
+    OpenCLSetup setup;
     vector <cl::Platform> platforms;
     cl::Platform::get(&platforms);
-    vector <cl::Device> devices;
-    platforms[0].getDevices(CL_DEVICE_TYPE_GPU, &devices);
+    platforms[0].getDevices(CL_DEVICE_TYPE_GPU, &setup.devices);
+    vector <cl::Device> &devices = setup.devices;
 
-    timer.checkPoint("Create context");
-    cl::Context ctx = cl::Context(
+    setup.ctx = cl::Context(
             devices,
             NULL,
             NULL,
             NULL,
             NULL
     );
-    timer.checkPoint("Context ready");
 
-    std::string vendor, deviceName;
+    // Printed in one piece, as the main thread may be writing at the same time
+    std::ostringstream info;
+    std::string vendor;
     platforms[0].getInfo(CL_PLATFORM_VENDOR, &vendor);
-    cout << platforms[0].getInfo<CL_PLATFORM_VERSION>() << endl;
+    info << platforms[0].getInfo<CL_PLATFORM_VERSION>() << endl;
 
-    cout << "Selected vendor " << vendor << " and devices " << endl;
+    info << "Selected vendor " << vendor << " and devices " << endl;
     for (auto device: devices) {
         std::string name;
         device.getInfo(CL_DEVICE_NAME, &name);
         vector <size_t> work_item_size = device.getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>();
-        cout << name << endl
+        info << name << endl
              << (device.getInfo<CL_DEVICE_LOCAL_MEM_TYPE>() == CL_LOCAL ? "local" : "global") << " memory" << endl
              << (device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>() / 1024) << " MBs" << endl
              << device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() << " compute units" << endl
@@ -103,91 +109,315 @@ int main(int argc, char *argv[]) {
              << "(" << work_item_size[0] << ", " << work_item_size[1] << ", " << work_item_size[2] <<
              ") max work item size" << endl;
     }
+    cout << info.str();
+
+    setup.queue = cl::CommandQueue(setup.ctx, devices[0], CL_QUEUE_PROFILING_ENABLE);
+
+    // Variants that have been built once are reused if the same parameters are asked for again,
+    // within the run from memory and across runs from the binaries kept on disk
+    setup.programs = std::make_shared<ProgramCache>(setup.ctx, resize_source, default_cache_directory());
+    return setup;
+}
+
+int main(int argc, char *argv[]) {
+    Timer timer = Timer();
+    timer.start();
+
+    // --autotune times the launch configurations of every kernel on this device before the run, and
+    // stores the fastest ones in the profile that later runs pick up
+    bool autotune = false;
+    // --factor=<n> reduces the input by n in both directions, and --downsample=area averages each n x n
+    // block instead of sampling its top left pixel
+    cl_uint factor = 4;
+    bool area_average = false;
+    vector<char *> args;
+    for (int i = 1; i < argc; i++) {
+        const string arg(argv[i]);
+        if (arg == "--autotune") {
+            autotune = true;
+        } else if (arg.compare(0, 9, "--factor=") == 0) {
+            factor = getIntArg(argv[i] + 9, 0);
+            if (factor == 0 || factor > 16) {
+                cerr << "Invalid downsampling factor " << argv[i] + 9 << ", expected 1 to 16" << endl;
+                return 1;
+            }
+        } else if (arg.compare(0, 13, "--downsample=") == 0) {
+            area_average = arg == "--downsample=area";
+            if (!area_average && arg != "--downsample=point") {
+                cerr << "Unknown downsampling " << argv[i] + 13 << ", expected point or area" << endl;
+                return 1;
+            }
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    const char *left_name = args.size() > 0 ? args[0] : "im0.png";
+    const char *right_name = args.size() > 1 ? args[1] : "im1.png";
+    const int ndisp = args.size() > 2 ? getIntArg(args[2], 70) : 70;
+    // Disparities 0..ndisp-1 are stored in 8 or 16 bits
+    if (ndisp < 1 || ndisp > 65536) {
+        cerr << "Invalid disparity range " << args[2] << ", expected 1 to 65536" << endl;
+        return 1;
+    }
+    const int thresh = args.size() > 3 ? getIntArg(args[3], 8) : 8;
 
-    cl::CommandQueue queue = cl::CommandQueue(ctx, devices[0], CL_QUEUE_PROFILING_ENABLE);
+    left.fileName = "left.png";
+    right.fileName = "right.png";
 
-    std::ifstream kernels("resize.cl");
-    std::string resize_text((std::istreambuf_iterator<char>(kernels)),
-                            std::istreambuf_iterator<char>());
+    // Window size, disparity range, threshold and pixel type are compiled into the kernels
+    const int window_size = 4;
+    const KernelVariant variant = {window_size, ndisp, thresh, "uchar"};
+
+    // The context is set up, the program built and both images decoded in parallel. The decoders
+    // only need the context once they write their rows to device-visible memory, so they start right
+    // away. Errors are thrown as cl::Error, a failed build after printing its log.
+    timer.checkPoint("Set up OpenCL, build program and load images");
+    std::promise<DeviceQueue> device_ready;
+    const std::shared_future<DeviceQueue> device = device_ready.get_future().share();
+    std::shared_future<OpenCLSetup> setup = std::async(std::launch::async, [&device_ready]() {
+        try {
+            OpenCLSetup opencl = setup_opencl();
+            device_ready.set_value({opencl.ctx, opencl.queue});
+            return opencl;
+        } catch (const cl::Error &) {
+            device_ready.set_exception(std::current_exception());
+            throw;
+        }
+    }).share();
+    std::future<cl::Program> program_build = std::async(std::launch::async, [setup, variant]() {
+        const OpenCLSetup &opencl = setup.get();
+        return opencl.programs->get(opencl.devices[0], variant);
+    });
+    // Point sampling only reads every factor-th row, so the others are dropped while decoding. The
+    // area average needs every row of a block.
+    const cl_uint block = area_average ? factor : 1;
+    std::future<DeviceImage> left_image = std::async(std::launch::async, [&]() {
+        return load_image(left_name, device, factor / block);
+    });
+    std::future<DeviceImage> right_image_load = std::async(std::launch::async, [&]() {
+        return load_image(right_name, device, factor / block);
+    });
+    OpenCLSetup opencl;
+    try {
+        opencl = setup.get();
+    } catch (const cl::Error &e) {
+        cerr << "OpenCL setup failed " << e.what() << " " << e.err() << endl;
+        return 1;
+    }
+    vector <cl::Device> &devices = opencl.devices;
+    cl::Context &ctx = opencl.ctx;
+    cl::CommandQueue &queue = opencl.queue;
+    DeviceImage right_image, left_loaded;
+    try {
+        right_image = right_image_load.get();
+        left_loaded = left_image.get();
+    } catch (const cl::Error &e) {
+        cerr << "Error loading images " << e.what() << " " << e.err() << endl;
+        return 1;
+    }
+    timer.checkPoint("Images loaded");
+    if (left_loaded.width == 0 || right_image.width == 0) {
+        return 1;
+    }
+    if (left_loaded.width != right_image.width || left_loaded.height != right_image.height) {
+        cerr << "Images must have the same size, got " << left_loaded.width << "x" << left_loaded.height
+             << " and " << right_image.width << "x" << right_image.height << endl;
+        return 1;
+    }
+    left.original = left_loaded.image;
+    right.original = right_image.image;
 
-    cl::Program program = cl::Program(ctx,
-                                      cl::Program::Sources(1, std::make_pair(resize_text.c_str(), resize_text.size())));
+    Image resizedImage = {};
+    resizedImage.width = left_loaded.width / factor;
+    resizedImage.height = left_loaded.height / block;
+    if (resizedImage.width == 0 || resizedImage.height == 0) {
+        cerr << "Images are smaller than the downsampling factor " << factor << endl;
+        return 1;
+    }
 
+    cl::Program program;
     try {
-        program.build(devices);
-    } catch (const cl::Error &) {
-        std::cerr
-                << "OpenCL compilation error" << endl
-                << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0])
-                << std::endl;
+        program = program_build.get();
+    } catch (const cl::Error &e) {
+        cerr << "OpenCL setup failed " << e.what() << " " << e.err() << endl;
         return 1;
     }
+    timer.checkPoint("OpenCL ready");
 
-    cl::ImageFormat imageFormat;
-    imageFormat.image_channel_order = CL_RGBA;
-    imageFormat.image_channel_data_type = CL_UNSIGNED_INT8;
-    cl::Image2D crossChecked, occlusionFilled;
-    cl_int image_err;
+    // Kernels missing from the profile are launched with the driver's work-group size
+    TuningProfile profile;
+    const string profile_path = tuning_profile_path(devices[0]);
+    if (!profile_path.empty() && profile.load(profile_path, devices[0]) && !autotune) {
+        cout << "Using tuning profile " << profile_path << endl;
+    }
+    const LaunchConfig driver_choice = {{0, 0, 0}, 0};
+
+    // Every intermediate holds one value per pixel, the disparities need 16 bits only for ranges that
+    // do not fit in a byte
+    const cl::ImageFormat imageFormat(CL_R, CL_UNSIGNED_INT8);
+    const size_t disparity_size = ndisp > 256 ? sizeof(cl_ushort) : sizeof(cl_uchar);
+    cl::Image2D occlusionFilled;
+
+    // Rows of the device buffers start on the device's base address alignment (given in bits), so
+    // every row read by a work group begins on a memory transaction boundary
+    const size_t row_alignment = std::max((size_t) devices[0].getInfo<CL_DEVICE_MEM_BASE_ADDR_ALIGN>() / 8,
+                                          sizeof(cl_uchar));
+    const cl_uint pitch = (resizedImage.width * sizeof(cl_uchar) + row_alignment - 1) / row_alignment
+                          * row_alignment / sizeof(cl_uchar);
+    const size_t plane = resizedImage.height * pitch;
+
+#ifdef SYMMETRIC_ZNCC
+    // Rows of the image scored at a time, the cost buffer holds ndisp x pitch scores per row
+    const vector<size_t> band_candidates = {4, 8, 16, 32};
+    LaunchConfig costLaunch = profile.get("zncc_cost_band", {{0, 0, 0}, 16}, 1, band_candidates);
+    const size_t max_band_rows = autotune ? band_candidates.back() : costLaunch.tile;
+#endif
 
+    // Buffers whose stages do not overlap share storage, so for example the cross-checked map reuses
+    // the memory of the greyscale buffers. The images cannot be aliased with buffers in OpenCL 1.2,
+    // so they are created late and released early instead, and only counted in the peak.
+    MemoryPlan plan(row_alignment);
+    plan.addExternal("left input", left_loaded.width * left_loaded.height * 4, PREPROCESS, PREPROCESS);
+    plan.addExternal("right input", right_image.width * right_image.height * 4, PREPROCESS, PREPROCESS);
+    const int left_gs = plan.add("left greyscale", plane * sizeof(cl_uchar), PREPROCESS, ZNCC);
+    const int right_gs = plan.add("right greyscale", plane * sizeof(cl_uchar), PREPROCESS, ZNCC);
+    const int left_stats = plan.add("left window stats", plane * sizeof(cl_float2), PREPROCESS, ZNCC);
+    const int right_stats = plan.add("right window stats", plane * sizeof(cl_float2), PREPROCESS, ZNCC);
+#ifdef SYMMETRIC_ZNCC
+    const int costs_buffer = plan.add("zncc costs", max_band_rows * ndisp * pitch * sizeof(float), ZNCC, ZNCC);
+#else
+    const int best_scores = plan.add("best scores", plane * sizeof(float), ZNCC, ZNCC);
+    const int best_indices = plan.add("best indices", plane * sizeof(cl_uint), ZNCC, ZNCC);
+#endif
+    const int left_disparities = plan.add("left disparities", plane * disparity_size, ZNCC, POST_PROCESS);
+    const int right_disparities = plan.add("right disparities", plane * disparity_size, ZNCC, POST_PROCESS);
+#ifdef SAVE_INTERMEDIATE_STEPS
+    const int cross_checked = plan.add("cross checked", plane * sizeof(cl_uchar), POST_PROCESS, POST_PROCESS);
+#endif
+#ifndef RING_FILL
+    const int feature_rows = plan.add("fill feature rows", plane * sizeof(cl_int), POST_PROCESS, POST_PROCESS);
+    const int envelope = plan.add("fill envelope", plane * sizeof(cl_int), POST_PROCESS, POST_PROCESS);
+    const int intersections = plan.add("fill intersections", plane * sizeof(cl_long), POST_PROCESS, POST_PROCESS);
+    const int denominators = plan.add("fill denominators", plane * sizeof(cl_int), POST_PROCESS, POST_PROCESS);
+#endif
+    plan.addExternal("occlusion filled", resizedImage.width * resizedImage.height, POST_PROCESS, POST_PROCESS);
 
-    size_t h = left.originalImage.height, w = left.originalImage.width;
     timer.checkPoint("Start creating OpenCL images");
     try {
-        left.original = cl::Image2D(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, imageFormat, w,
-                                    h, 0, &left.originalImage.pixels[0], &image_err);
-        left.gs = cl::Buffer(ctx, CL_MEM_READ_WRITE, resizedImage.height * resizedImage.width * sizeof(uint), NULL,
-                             NULL);
-        left.for_mean = cl::Image2D(ctx, CL_MEM_READ_WRITE, imageFormat, resizedImage.width, resizedImage.height, 0,
-                                    NULL, &image_err);
-        left.meaned = cl::Image2D(ctx, CL_MEM_READ_WRITE, imageFormat, resizedImage.width, resizedImage.height, 0,
-                                  NULL, &image_err);
-        left.znccd = cl::Image2D(ctx, CL_MEM_READ_WRITE, imageFormat, resizedImage.width, resizedImage.height, 0, NULL,
-                                 &image_err);
-
-        right.original = cl::Image2D(ctx, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, imageFormat, w,
-                                     h, 0, &right.originalImage.pixels[0], &image_err);
-        right.gs = cl::Buffer(ctx, CL_MEM_READ_WRITE, resizedImage.height * resizedImage.width * sizeof(uint), NULL,
-                              NULL);
-        right.for_mean = cl::Image2D(ctx, CL_MEM_READ_WRITE, imageFormat, resizedImage.width, resizedImage.height, 0,
-                                     NULL, &image_err);
-        right.meaned = cl::Image2D(ctx, CL_MEM_READ_WRITE, imageFormat, resizedImage.width, resizedImage.height, 0,
-                                   NULL, &image_err);
-        right.znccd = cl::Image2D(ctx, CL_MEM_READ_WRITE, imageFormat, resizedImage.width, resizedImage.height, 0,
-                                  NULL, &image_err);
-
-        crossChecked = cl::Image2D(ctx, CL_MEM_READ_WRITE, imageFormat, resizedImage.width, resizedImage.height, 0,
-                                   NULL, &image_err);
-        occlusionFilled = cl::Image2D(ctx, CL_MEM_WRITE_ONLY, imageFormat, resizedImage.width, resizedImage.height, 0,
-                                      NULL, &image_err);
-
+        plan.allocate(ctx, devices[0].getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>());
+        left.gs = plan.get(left_gs);
+        right.gs = plan.get(right_gs);
+        left.stats = plan.get(left_stats);
+        right.stats = plan.get(right_stats);
+        left.znccd = plan.get(left_disparities);
+        right.znccd = plan.get(right_disparities);
     } catch (const cl::Error &ex) {
-        std::cerr
-                << "Error creating image " << endl << ex.what() << " " << ex.err() << endl << "Error " << image_err
-                << endl;
+        std::cerr << "Error creating image " << endl << ex.what() << " " << ex.err() << endl;
         return 1;
     }
-
-    if (image_err != CL_SUCCESS)
-        return 1;
+    plan.report(cout);
     timer.checkPoint("Images ready");
 
 
-    cl::Kernel resize(program, "resize");
-    cl::Kernel mean(program, "calculate_mean");
+    cl::Kernel preprocess(program, "preprocess");
     cl::Kernel zncc(program, "calculate_zncc");
-    cl::Kernel crossCheck(program, "cross_check");
-    cl::Kernel occlusionFill(program, "nearest_nonzero");
+#ifdef RING_FILL
+    cl::Kernel crossCheckFill(program, "cross_check_fill");
+#else
+    cl::Kernel edtColumns(program, "edt_columns");
+    cl::Kernel edtRows(program, "edt_fill_rows");
+#endif
 
     try {
-        resize.setArg(0, resizedImage.width);
-        resize.setArg(1, resizedImage.height);
-        mean.setArg(2, 4);
-        mean.setArg(3, 735);
+        preprocess.setArg(0, left.original);
+        preprocess.setArg(1, right.original);
+        preprocess.setArg(2, left.gs);
+        preprocess.setArg(3, right.gs);
+        preprocess.setArg(4, left.stats);
+        preprocess.setArg(5, right.stats);
+        preprocess.setArg(6, (cl_uint) resizedImage.width);
+        preprocess.setArg(7, (cl_uint) resizedImage.height);
+        preprocess.setArg(8, pitch);
+        preprocess.setArg(9, factor);
+        preprocess.setArg(10, block);
     } catch (const cl::Error &ex) {
         std::cerr << ex.what() << " " << ex.err() << endl;
         return 1;
     }
 
+#if defined(RING_FILL) || defined(SAVE_INTERMEDIATE_STEPS)
+    // One run of a kernel over every pixel of the resized image
+    auto enqueue_2d = [&](cl::Kernel &kernel, const LaunchConfig &config, const vector<cl::Event> *wait,
+                          cl::Event *event) {
+        return queue.enqueueNDRangeKernel(kernel, cl::NullRange,
+                                          config.globalRange(resizedImage.width, resizedImage.height),
+                                          config.localRange(2), wait, event);
+    };
+#endif
+#ifdef RING_FILL
+    auto tune_2d = [&](cl::Kernel &kernel, const string &name) {
+        profile.set(name, tune_kernel(queue, name, launch_candidates(kernel, devices[0], 2),
+                                      [&](const LaunchConfig &config) {
+                                          cl::Event event;
+                                          enqueue_2d(kernel, config, NULL, &event);
+                                          return vector<cl::Event>(1, event);
+                                      }));
+    };
+#else
+    // One run of a kernel with a work item per column or row
+    auto enqueue_1d = [&](cl::Kernel &kernel, const LaunchConfig &config, size_t items,
+                          const vector<cl::Event> *wait, cl::Event *event) {
+        return queue.enqueueNDRangeKernel(kernel, cl::NullRange, config.globalRange(items, 1), config.localRange(2),
+                                          wait, event);
+    };
+    auto tune_1d = [&](cl::Kernel &kernel, const string &name, size_t items) {
+        profile.set(name, tune_kernel(queue, name, launch_candidates(kernel, devices[0], 1),
+                                      [&](const LaunchConfig &config) {
+                                          cl::Event event;
+                                          enqueue_1d(kernel, config, items, NULL, &event);
+                                          return vector<cl::Event>(1, event);
+                                      }));
+    };
+#endif
+
+    // The preprocessing runs both views in one launch, with z selecting the view. Its tiles are the
+    // size of the work group and are held in local memory with their halo, so the work-group size is
+    // always given.
+    const int window_width = 2 * window_size + 1;
+    const LaunchConfig preprocessDefault = {{16, 8, 1}, 0};
+    auto grey_bytes = [&](const LaunchConfig &config) {
+        return (config.local[0] + window_width - 1) * (config.local[1] + window_width - 1) * sizeof(cl_uchar);
+    };
+    auto sums_bytes = [&](const LaunchConfig &config) {
+        return config.local[0] * (config.local[1] + window_width - 1) * sizeof(cl_uint2);
+    };
+    auto enqueue_preprocess = [&](const LaunchConfig &config, cl::Event *event) {
+        preprocess.setArg(11, grey_bytes(config), NULL);
+        preprocess.setArg(12, sums_bytes(config), NULL);
+        return queue.enqueueNDRangeKernel(preprocess, cl::NullRange,
+                                          config.globalRange(resizedImage.width, resizedImage.height, 2),
+                                          config.localRange(3), NULL, event);
+    };
+
+    if (autotune) {
+        timer.checkPoint("Tune preprocessing");
+        vector<LaunchConfig> candidates = launch_candidates(preprocess, devices[0], 2);
+        const size_t local_memory = devices[0].getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+        candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [&](const LaunchConfig &config) {
+            return config.local[0] == 0 || grey_bytes(config) + sums_bytes(config) > local_memory;
+        }), candidates.end());
+        try {
+            profile.set("preprocess", tune_kernel(queue, "preprocess", candidates, [&](const LaunchConfig &config) {
+                cl::Event event;
+                enqueue_preprocess(config, &event);
+                return vector<cl::Event>(1, event);
+            }));
+        } catch (const cl::Error &ex) {
+            std::cerr << ex.what() << " " << ex.err() << endl;
+            return 1;
+        }
+    }
+
     cl::size_t<3> start;
     start[0] = 0;
     start[1] = 0;
@@ -198,166 +428,330 @@ int main(int argc, char *argv[]) {
     end[1] = resizedImage.height;
     end[2] = 1;
 
-    vector <cl::Event> meanEvents = vector<cl::Event>();
-    vector <cl::Event> resizeEvents = vector<cl::Event>();
-    timer.checkPoint("Resize and grayscale");
-    for (auto set : {left, right}) {
-        try {
-            resize.setArg(2, set.original);
-            resize.setArg(3, set.gs);
-            mean.setArg(0, set.gs);
-            mean.setArg(1, set.meaned);
-        } catch (const cl::Error &ex) {
-            std::cerr << ex.what() << " " << ex.err() << endl;
-            return 1;
-        }
-
-        cl_int err;
-        cl::Event e1, e2;
-        vector <cl::Event> resizeEvent = vector<cl::Event>();
-
-        err = queue.enqueueNDRangeKernel(resize, cl::NullRange, cl::NDRange(resizedImage.width, resizedImage.height),
-                                         cl::NullRange, NULL, &e1);
-        resizeEvent.push_back(e1);
-        resizeEvents.push_back(e1);
-        err = queue.enqueueNDRangeKernel(mean, cl::NullRange, cl::NDRange(resizedImage.width, resizedImage.height),
-                                         cl::NullRange, &resizeEvent, &e2);
-        meanEvents.push_back(e2);
-        if (err != CL_SUCCESS) {
-            cout << "Error in queue " << err << endl;
-            return 1;
+    vector <cl::Event> preprocessEvents = vector<cl::Event>();
+    timer.checkPoint("Resize, grayscale and window statistics");
+    try {
+        cl::Event e1;
+        LaunchConfig preprocessLaunch = profile.get("preprocess", preprocessDefault, 2);
+        if (preprocessLaunch.local[0] == 0) {
+            preprocessLaunch = preprocessDefault;
         }
+        enqueue_preprocess(preprocessLaunch, &e1);
+        preprocessEvents.push_back(e1);
+    } catch (const cl::Error &ex) {
+        cout << "Error in queue " << ex.what() << " " << ex.err() << endl;
+        return 1;
+    }
 
 #ifdef SAVE_INTERMEDIATE_STEPS
-        e2.wait();
-        timer.checkPoint("Save image");
-        save_image_to_disk(string("gs_").append(set.fileName), queue, set.for_mean, start, end);
-        timer.checkPoint("Save ready");
-#endif
+    cl::Event::waitForEvents(preprocessEvents);
+    timer.checkPoint("Save image");
+    for (auto set : {left, right}) {
+        save_buffer_to_disk(string("gs_").append(set.fileName), queue, set.gs, resizedImage.width,
+                            resizedImage.height, pitch, sizeof(cl_uchar));
     }
+    timer.checkPoint("Save ready");
+#endif
+    // The queue is in order, so the inputs are only freed once the preprocessing has read them
+    left.original = cl::Image2D();
+    right.original = cl::Image2D();
 
-    zncc.setArg(5, 64);
-    zncc.setArg(6, 64 * sizeof(float), NULL);
-    zncc.setArg(7, sizeof(float), NULL);
-    zncc.setArg(8, 4);
-    zncc.setArg(10, 735);
-    zncc.setArg(11, 504);
     vector <cl::Event> znccEvents = vector<cl::Event>();
 
-    timer.checkPoint("Start zncc");
-    for (int i = 0; i < 2; i++) {
-        vector <uint8_t> output(resizedImage.height * resizedImage.width * 4);
-        int min_disp, max_disp;
-        min_disp = i == 0 ? 0 : -ndisp;
-        max_disp = i == 0 ? ndisp : 0;
-        imageSet l = i == 0 ? left : right;
-        imageSet r = i == 0 ? right : left;
-
-        zncc.setArg(0, sizeof(l.gs), &l.gs);
-        zncc.setArg(1, sizeof(r.gs), &r.gs);
-        zncc.setArg(2, l.meaned);
-        zncc.setArg(3, r.meaned);
-        zncc.setArg(4, l.znccd);
-        zncc.setArg(9, i == 0 ? 1 : -1);
+#ifdef SYMMETRIC_ZNCC
+    cl::Kernel costBand(program, "zncc_cost_band");
+    cl::Kernel selectDisparities(program, "select_disparities");
+    cl::Buffer costs = plan.get(costs_buffer);
+    try {
+        costBand.setArg(0, left.gs);
+        costBand.setArg(1, right.gs);
+        costBand.setArg(2, left.stats);
+        costBand.setArg(3, right.stats);
+        costBand.setArg(4, costs);
+        costBand.setArg(5, (cl_uint) resizedImage.width);
+        costBand.setArg(6, (cl_uint) resizedImage.height);
+        costBand.setArg(8, pitch);
+        selectDisparities.setArg(0, costs);
+        selectDisparities.setArg(1, left.znccd);
+        selectDisparities.setArg(2, right.znccd);
+        selectDisparities.setArg(3, (cl_uint) resizedImage.width);
+        selectDisparities.setArg(5, pitch);
+    } catch (const cl::Error &e) {
+        cout << e.what() << " " << e.err() << endl;
+        return 1;
+    }
 
-        cl::Event e1;
-        try {
-            int err = queue.enqueueNDRangeKernel(zncc, cl::NullRange,
-                                                 cl::NDRange(resizedImage.width, resizedImage.height, 64),
-                                                 cl::NDRange(1, 1, 64),
-                                                 &meanEvents,
-                                                 &e1);
-            if (err != CL_SUCCESS) {
-                cout << "zncc err " << err << endl;
-                return 1;
-            }
-        } catch (const cl::Error &e) {
-            cout << "hv " << e.what() << " " << e.err() << endl;
-            return 1;
+    // Enqueues every band of the image. The queue is in order, so each band waits for the previous one
+    // to finish with the cost buffer. Both kernels are spread over x only, as every item of
+    // select_disparities reads a whole column of scores.
+    auto enqueue_bands = [&](const LaunchConfig &cost, const LaunchConfig &select, const vector<cl::Event> *wait,
+                             vector<cl::Event> &costEvents, vector<cl::Event> &selectEvents) {
+        for (size_t band_start = 0; band_start < resizedImage.height; band_start += cost.tile) {
+            size_t band_rows = std::min(cost.tile, resizedImage.height - band_start);
+            cl::Event e1, e2;
+            costBand.setArg(7, (cl_uint) band_start);
+            selectDisparities.setArg(4, (cl_uint) band_start);
+            queue.enqueueNDRangeKernel(costBand, cl::NullRange,
+                                       cost.globalRange(resizedImage.width, band_rows, ndisp), cost.localRange(3),
+                                       wait, &e1);
+            queue.enqueueNDRangeKernel(selectDisparities, cl::NullRange,
+                                       select.globalRange(resizedImage.width, band_rows), select.localRange(2),
+                                       NULL, &e2);
+            costEvents.push_back(e1);
+            selectEvents.push_back(e2);
         }
-        znccEvents.push_back(e1);
+    };
 
-#ifdef  SAVE_INTERMEDIATE_STEPS
+    if (autotune) {
+        timer.checkPoint("Tune zncc");
         try {
-            e1.wait();
+            costLaunch = tune_kernel(queue, "zncc_cost_band",
+                                     launch_candidates(costBand, devices[0], 1, band_candidates),
+                                     [&](const LaunchConfig &config) {
+                                         vector<cl::Event> costEvents, selectEvents;
+                                         enqueue_bands(config, driver_choice, NULL, costEvents, selectEvents);
+                                         return costEvents;
+                                     });
+            profile.set("zncc_cost_band", costLaunch);
+            profile.set("select_disparities",
+                        tune_kernel(queue, "select_disparities", launch_candidates(selectDisparities, devices[0], 1),
+                                    [&](const LaunchConfig &config) {
+                                        vector<cl::Event> costEvents, selectEvents;
+                                        enqueue_bands(costLaunch, config, NULL, costEvents, selectEvents);
+                                        return selectEvents;
+                                    }));
         } catch (const cl::Error &e) {
-            cout << "save hv " << e.what() << " " << e.err() << endl;
+            cout << e.what() << " " << e.err() << endl;
             return 1;
         }
-        timer.checkPoint("Zncc ready");
-        save_image_to_disk(string("").append(l.fileName), queue, l.znccd, start, end);
-#endif
     }
 
-    crossCheck.setArg(0, left.znccd);
-    crossCheck.setArg(1, right.znccd);
-    crossCheck.setArg(2, crossChecked);
-    crossCheck.setArg(3, thresh);
-    crossCheck.setArg(4, ndisp);
-
-    cl::Event e1;
-    int err;
+    timer.checkPoint("Start zncc");
     try {
-        err = queue.enqueueNDRangeKernel(crossCheck, cl::NullRange,
-                                         cl::NDRange(resizedImage.width, resizedImage.height), cl::NullRange,
-                                         &znccEvents, &e1);
-        if (err != CL_SUCCESS) {
-            cout << "crossCheck error " << err << endl;
-            return 1;
-        }
+        enqueue_bands(costLaunch, profile.get("select_disparities", driver_choice, 1), &preprocessEvents, znccEvents,
+                      znccEvents);
     } catch (const cl::Error &e) {
-        cout << e.what() << " " << e.err() << endl;
+        cout << "zncc band " << e.what() << " " << e.err() << endl;
         return 1;
     }
-    vector <cl::Event> crossCheckEvents = vector<cl::Event>();
-    crossCheckEvents.push_back(e1);
-
-    vector <uint8_t> crosschecked(resizedImage.height * resizedImage.width * 4);
 
 #ifdef SAVE_INTERMEDIATE_STEPS
-    e1.wait();
-    save_image_to_disk("cross_checked.png", queue, crossChecked, start, end);
+    cl::Event::waitForEvents(znccEvents);
+    timer.checkPoint("Zncc ready");
+    save_buffer_to_disk(left.fileName, queue, left.znccd, resizedImage.width, resizedImage.height, pitch,
+                        disparity_size);
+    save_buffer_to_disk(right.fileName, queue, right.znccd, resizedImage.width, resizedImage.height, pitch,
+                        disparity_size);
 #endif
+#else
+    // Pixels of a row scored by one calculate_zncc work group, sharing one copy of their windows
+    const LaunchConfig znccDefault = {{0, 0, 0}, 16};
+    const vector<size_t> tile_candidates = {4, 8, 16, 32, 64};
+    auto tile_bytes = [&](size_t tile_width, size_t group_size) {
+        return (window_width * (2 * tile_width + 4 * window_size + group_size - 1) + 2 * tile_width + group_size - 1)
+               * sizeof(cl_int);
+    };
+
+    // A work group holds one item per disparity, so ranges larger than the device allows are split
+    // into chunks that are launched one after another and merged on the device
+    size_t max_chunk_size = std::min(devices[0].getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>(),
+                                     devices[0].getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>()[2]);
+    max_chunk_size = std::min(max_chunk_size, zncc.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(devices[0]));
+    max_chunk_size = std::min(max_chunk_size, (size_t) ndisp);
+    auto chunk_size_for = [&](size_t tile_width) {
+        size_t chunk_size = max_chunk_size;
+        // The halo of the right strip grows with the chunk, which must still fit in local memory
+        while (chunk_size > 1 && tile_bytes(tile_width, chunk_size) + chunk_size * (sizeof(float) + sizeof(cl_uint))
+                                 + (2 * tile_width + chunk_size - 1) * sizeof(float) > devices[0].getInfo<CL_DEVICE_LOCAL_MEM_SIZE>()) {
+            chunk_size /= 2;
+        }
+        return chunk_size;
+    };
+    cl::Buffer bestScores = plan.get(best_scores);
+    cl::Buffer bestIndices = plan.get(best_indices);
+
+    zncc.setArg(8, (cl_uint) resizedImage.width);
+    zncc.setArg(9, (cl_uint) resizedImage.height);
+    zncc.setArg(14, bestScores);
+    zncc.setArg(15, bestIndices);
+    zncc.setArg(16, pitch);
+
+    // Enqueues both directions. The queue is in order, so each chunk sees the best scores merged by the
+    // previous ones.
+    auto enqueue_zncc = [&](const LaunchConfig &config, const vector<cl::Event> *wait) {
+        const size_t tile_width = config.tile;
+        const size_t tiles = (resizedImage.width + tile_width - 1) / tile_width;
+        const size_t chunk_size = chunk_size_for(tile_width);
+        zncc.setArg(10, (cl_int) tile_width);
+
+        vector<cl::Event> events;
+        for (int i = 0; i < 2; i++) {
+            imageSet &l = i == 0 ? left : right;
+            imageSet &r = i == 0 ? right : left;
+            zncc.setArg(0, sizeof(l.gs), &l.gs);
+            zncc.setArg(1, sizeof(r.gs), &r.gs);
+            zncc.setArg(2, l.stats);
+            zncc.setArg(3, r.stats);
+            zncc.setArg(4, l.znccd);
+            zncc.setArg(7, i == 0 ? 1 : -1);
+
+            for (size_t disp_offset = 0; disp_offset < (size_t) ndisp; disp_offset += chunk_size) {
+                const size_t group_size = std::min(chunk_size, ndisp - disp_offset);
+                cl::Event e1;
+                zncc.setArg(5, group_size * sizeof(float), NULL);
+                zncc.setArg(6, group_size * sizeof(cl_uint), NULL);
+                zncc.setArg(11, tile_bytes(tile_width, group_size), NULL);
+                zncc.setArg(12, (2 * tile_width + group_size - 1) * sizeof(float), NULL);
+                zncc.setArg(13, (cl_uint) disp_offset);
+                queue.enqueueNDRangeKernel(zncc, cl::NullRange, cl::NDRange(tiles, resizedImage.height, group_size),
+                                           cl::NDRange(1, 1, group_size), wait, &e1);
+                events.push_back(e1);
+            }
+        }
+        return events;
+    };
+
+    if (autotune) {
+        timer.checkPoint("Tune zncc");
+        // The work-group shape is fixed by the chunk, so only the pixels per group are swept
+        vector<LaunchConfig> candidates;
+        for (size_t tile_width : tile_candidates) {
+            candidates.push_back({{0, 0, 0}, tile_width});
+        }
+        profile.set("calculate_zncc", tune_kernel(queue, "calculate_zncc", candidates,
+                                                  [&](const LaunchConfig &config) {
+                                                      return enqueue_zncc(config, NULL);
+                                                  }));
+    }
 
-    occlusionFill.setArg(0, crossChecked);
-    occlusionFill.setArg(1, occlusionFilled);
-
-    cl::Event e2;
-    timer.checkPoint("Cross check ready");
+    const LaunchConfig znccLaunch = profile.get("calculate_zncc", znccDefault, 1, tile_candidates);
+    cout << "Disparities in chunks of " << chunk_size_for(znccLaunch.tile) << " for " << znccLaunch.tile
+         << " pixels per group" << endl;
+    timer.checkPoint("Start zncc");
     try {
-        err = queue.enqueueNDRangeKernel(occlusionFill, cl::NullRange,
-                                         cl::NDRange(resizedImage.width, resizedImage.height), cl::NullRange,
-                                         &crossCheckEvents, &e2);
+        znccEvents = enqueue_zncc(znccLaunch, &preprocessEvents);
     } catch (const cl::Error &e) {
-        cout << e.what() << " " << e.what() << endl;
+        cout << "zncc " << e.what() << " " << e.err() << endl;
         return 1;
     }
 
-    vector <uint8_t> output(resizedImage.height * resizedImage.width * 4);
+#ifdef  SAVE_INTERMEDIATE_STEPS
+    cl::Event::waitForEvents(znccEvents);
+    timer.checkPoint("Zncc ready");
+    save_buffer_to_disk(left.fileName, queue, left.znccd, resizedImage.width, resizedImage.height, pitch,
+                        disparity_size);
+    save_buffer_to_disk(right.fileName, queue, right.znccd, resizedImage.width, resizedImage.height, pitch,
+                        disparity_size);
+#endif
 
+#endif
+    try {
+        // The result is mapped by the encoder, so it lives in host-visible memory
+        occlusionFilled = cl::Image2D(ctx, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, imageFormat,
+                                      resizedImage.width, resizedImage.height);
+#ifdef RING_FILL
+        crossCheckFill.setArg(0, left.znccd);
+        crossCheckFill.setArg(1, right.znccd);
+        crossCheckFill.setArg(2, occlusionFilled);
+        crossCheckFill.setArg(3, pitch);
+#else
+        edtColumns.setArg(0, left.znccd);
+        edtColumns.setArg(1, right.znccd);
+        edtColumns.setArg(2, plan.get(feature_rows));
+        edtColumns.setArg(3, (cl_uint) resizedImage.width);
+        edtColumns.setArg(4, (cl_uint) resizedImage.height);
+        edtColumns.setArg(5, pitch);
+        edtRows.setArg(0, left.znccd);
+        edtRows.setArg(1, right.znccd);
+        edtRows.setArg(2, plan.get(feature_rows));
+        edtRows.setArg(3, plan.get(envelope));
+        edtRows.setArg(4, plan.get(intersections));
+        edtRows.setArg(5, plan.get(denominators));
+        edtRows.setArg(6, occlusionFilled);
+        edtRows.setArg(7, (cl_uint) resizedImage.width);
+        edtRows.setArg(8, (cl_uint) resizedImage.height);
+        edtRows.setArg(9, pitch);
+#endif
+    } catch (const cl::Error &e) {
+        cout << e.what() << " " << e.err() << endl;
+        return 1;
+    }
 
+    if (autotune) {
+        timer.checkPoint("Tune cross check and occlusion fill");
+        try {
+#ifdef RING_FILL
+            tune_2d(crossCheckFill, "cross_check_fill");
+#else
+            // The rows pass reads what the columns pass left behind while it was tuned
+            tune_1d(edtColumns, "edt_columns", resizedImage.width);
+            tune_1d(edtRows, "edt_fill_rows", resizedImage.height);
+#endif
+        } catch (const cl::Error &e) {
+            cout << e.what() << " " << e.err() << endl;
+            return 1;
+        }
+        if (profile_path.empty() || !profile.save(profile_path)) {
+            cerr << "Could not save the tuning profile " << profile_path << endl;
+        } else {
+            cout << "Tuning profile saved to " << profile_path << endl;
+        }
+    }
+
+#ifdef SAVE_INTERMEDIATE_STEPS
+    // The fused kernel never stores the cross-checked map, so it is computed separately to be saved
     try {
-        e2.wait();
+        cl::Kernel crossCheck(program, "cross_check");
+        cl::Buffer crossChecked = plan.get(cross_checked);
+        crossCheck.setArg(0, left.znccd);
+        crossCheck.setArg(1, right.znccd);
+        crossCheck.setArg(2, crossChecked);
+        crossCheck.setArg(3, (cl_uint) resizedImage.width);
+        crossCheck.setArg(4, (cl_uint) resizedImage.height);
+        crossCheck.setArg(5, pitch);
+        cl::Event checked;
+        enqueue_2d(crossCheck, driver_choice, &znccEvents, &checked);
+        checked.wait();
+        save_buffer_to_disk("cross_checked.png", queue, crossChecked, resizedImage.width, resizedImage.height, pitch,
+                            sizeof(cl_uchar));
     } catch (const cl::Error &e) {
         cout << e.what() << " " << e.err() << endl;
         return 1;
     }
-    timer.checkPoint("Occlusion fill ready");
+#endif
 
-    for (auto e : resizeEvents) {
-        cout << "Resize ready in " << outputEventExecutionTime(e) << endl;
+    vector <cl::Event> fillEvents = vector<cl::Event>();
+    timer.checkPoint("Cross check and occlusion fill");
+    try {
+        cl::Event e1;
+#ifdef RING_FILL
+        enqueue_2d(crossCheckFill, profile.get("cross_check_fill", driver_choice, 2), &znccEvents, &e1);
+        fillEvents.push_back(e1);
+#else
+        cl::Event e2;
+        enqueue_1d(edtColumns, profile.get("edt_columns", driver_choice, 1), resizedImage.width, &znccEvents, &e1);
+        enqueue_1d(edtRows, profile.get("edt_fill_rows", driver_choice, 1), resizedImage.height, NULL, &e2);
+        fillEvents.push_back(e1);
+        fillEvents.push_back(e2);
+#endif
+        cl::Event::waitForEvents(fillEvents);
+    } catch (const cl::Error &e) {
+        cout << e.what() << " " << e.err() << endl;
+        return 1;
     }
+    timer.checkPoint("Occlusion fill ready");
 
-    for (auto e : meanEvents) {
-        cout << "Mean ready in " << outputEventExecutionTime(e) << endl;
+    for (auto e : preprocessEvents) {
+        cout << "Preprocessing ready in " << outputEventExecutionTime(e) << endl;
     }
 
     for (auto e : znccEvents) {
         cout << "Zncc ready in " << outputEventExecutionTime(e) << endl;
     }
 
-    cout << "Cross check ready in " << outputEventExecutionTime(e1) << endl;
-    cout << "Occlusion fill ready in " << outputEventExecutionTime(e2) << endl;
+    for (auto e : fillEvents) {
+        cout << "Cross check and occlusion fill ready in " << outputEventExecutionTime(e) << endl;
+    }
     save_image_to_disk("ready.png", queue, occlusionFilled, start, end);
 
     timer.stop();
@@ -1,154 +1,410 @@
-__kernel void resize(
-        const long width,
-        const long height,
-        __read_only image2d_t original,
-        __global uint * buffer
-        ){
+/* Parameters compiled in by the host as -D build options. Being constants, the window loops have a
+ * fixed trip count and can be unrolled with the accumulators kept in registers. The defaults are the
+ * values used in the README.
+ */
+#ifndef WINDOW_SIZE
+#define WINDOW_SIZE 4
+#endif
+#ifndef MAX_DISP
+#define MAX_DISP 64
+#endif
+#ifndef CC_THRESHOLD
+#define CC_THRESHOLD 8
+#endif
+// Element type of the greyscale buffers
+#ifndef PIXEL_T
+#define PIXEL_T uchar
+#endif
 
-    int x = get_global_id(0);
-    int y = get_global_id(1);
-    int2 coord = {x*4, y*4};
-    sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_NONE | CLK_FILTER_LINEAR;
-    uint4 pixel = read_imageui(original, sampler, coord);
-    uint gs = (uint) (pixel.s0 * 0.2126 + pixel.s1 * 0.7152 + pixel.s2 * 0.0722);
-    buffer[y * width + x] = gs;
+// Element type of the disparity maps, which need 16 bits only for ranges that do not fit in a byte
+#if MAX_DISP > 256
+#define DISP_T ushort
+#else
+#define DISP_T uchar
+#endif
+
+/* Apart from the input, images hold a single channel (CL_R) that is read from and written to .s0.
+ * The window statistics, disparity and cross-checked maps are buffers with the same row pitch as the
+ * greyscale buffers, so the host can place them in storage that earlier stages no longer use.
+ */
+
+/* Luma weights 0.2126, 0.7152 and 0.0722 in units of 1/32768, the same integers as in
+ * c-impl/preprocess.h so both implementations produce the same greyscale images
+ */
+#define LUMA_R 6966
+#define LUMA_G 23436
+#define LUMA_B 2366
+#define LUMA_SHIFT 15
+
+/* Mean of a window from the sums of its pixels and of their squares, truncated as the C++
+ * implementation does, and the inverse of its deviation sqrt(sum((p - mean)^2))
+ */
+float2 window_statistics(uint2 sums) {
+    const uint count = (2 * WINDOW_SIZE + 1) * (2 * WINDOW_SIZE + 1);
+    uint mean = sums.s0 / count;
+    // sum((p - m)^2) = sum(p^2) - 2m * sum(p) + n * m^2
+    long deviation = (long) sums.s1 - 2 * (long) mean * sums.s0 + (long) count * mean * mean;
+    return (float2) (mean, rsqrt((float) deviation));
 }
 
+/* Resizes both views to greyscale and computes their window statistics in one launch, with z selecting
+ * the view. Each work group converts its tile of the output and a halo of WINDOW_SIZE pixels around
+ * it, clamped to the image edge, into local memory. Each pixel is the average of a block x block
+ * square of the original, starting at every factor-th column. With point sampling the rows have
+ * already been decimated on load and block is 1. The group writes its tile to the greyscale buffer and
+ * then sums the windows of the tile from local memory, with running sums along each row of tile and
+ * halo and then down each column. Every window thus costs the same whatever its size, so the ZNCC
+ * kernels only have to compute the numerator per disparity.
+ * grey holds (tile_width + 2 * WINDOW_SIZE) * (tile_height + 2 * WINDOW_SIZE) values and row_sums
+ * tile_width * (tile_height + 2 * WINDOW_SIZE), the tile being the size of the work group.
+ */
+__kernel void preprocess(
+        __read_only image2d_t left_original,
+        __read_only image2d_t right_original,
+        __global PIXEL_T * left_gs,
+        __global PIXEL_T * right_gs,
+        __global float2 * left_stats,
+        __global float2 * right_stats,
+        uint width,
+        uint height,
+        uint pitch,
+        uint factor,
+        uint block,
+        __local uchar * grey,
+        __local uint2 * row_sums
+        ){
+    sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_NONE | CLK_FILTER_NEAREST;
+    int view = get_global_id(2);
+    int tile_width = get_local_size(0);
+    int tile_height = get_local_size(1);
+    int x0 = get_group_id(0) * tile_width;
+    int y0 = get_group_id(1) * tile_height;
+    int item = get_local_id(1) * tile_width + get_local_id(0);
+    int items = tile_width * tile_height;
+    int grey_width = tile_width + 2 * WINDOW_SIZE;
+    int grey_height = tile_height + 2 * WINDOW_SIZE;
+    __global PIXEL_T * gs = view == 0 ? left_gs : right_gs;
+    __global float2 * stats = view == 0 ? left_stats : right_stats;
 
-__kernel void calculate_mean(
-    __global uint * input,
-    __write_only image2d_t output,
-    int window_size,
-    int width
-    ) {
-    int x = get_global_id(0);
-    int y = get_global_id(1);
-    int2 coord = {x, y};
+    for (int i = item; i < grey_width * grey_height; i += items) {
+        int x = clamp(x0 - WINDOW_SIZE + i % grey_width, 0, (int) width - 1);
+        int y = clamp(y0 - WINDOW_SIZE + i / grey_width, 0, (int) height - 1);
+        // Whole pixels are read and summed as vectors, all channels at once
+        uint4 sum = (uint4) (0, 0, 0, 0);
+        for (int dy = 0; dy < block; dy++) {
+            for (int dx = 0; dx < block; dx++) {
+                int2 coord = {x * factor + dx, y * block + dy};
+                sum += view == 0 ? read_imageui(left_original, sampler, coord)
+                                 : read_imageui(right_original, sampler, coord);
+            }
+        }
+        grey[i] = (sum.s0 * LUMA_R + sum.s1 * LUMA_G + sum.s2 * LUMA_B) / (block * block) >> LUMA_SHIFT;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    int x = x0 + get_local_id(0);
+    int y = y0 + get_local_id(1);
+    // Global sizes are rounded up to whole work groups
+    if (x < width && y < height) {
+        gs[y * pitch + x] = grey[(get_local_id(1) + WINDOW_SIZE) * grey_width + get_local_id(0) + WINDOW_SIZE];
+    }
 
-    ulong mean = 0;
-    for (int y1 = - window_size; y1 <= window_size ; y1++) {
-        for (int x1 = -window_size ; x1 <= window_size ; x1++) {
-            mean += input[(y+y1)*width + x];
+    for (int row = item; row < grey_height; row += items) {
+        __local uchar * line = grey + row * grey_width;
+        uint2 sums = (uint2) (0, 0);
+        for (int i = 0; i < 2 * WINDOW_SIZE + 1; i++) {
+            uint p = line[i];
+            sums += (uint2) (p, p * p);
+        }
+        row_sums[row * tile_width] = sums;
+        for (int column = 1; column < tile_width; column++) {
+            uint in = line[column + 2 * WINDOW_SIZE];
+            uint out = line[column - 1];
+            sums += (uint2) (in, in * in) - (uint2) (out, out * out);
+            row_sums[row * tile_width + column] = sums;
         }
     }
+    barrier(CLK_LOCAL_MEM_FENCE);
 
-    uint val = (uint) (mean / ((2*window_size+1)*(2*window_size+1)));
-    uint4 pix = {val, val, val, 255};
-    write_imageui(output, coord, pix);
+    for (int column = item; column < tile_width; column += items) {
+        uint2 sums = (uint2) (0, 0);
+        for (int i = 0; i < 2 * WINDOW_SIZE + 1; i++) {
+            sums += row_sums[i * tile_width + column];
+        }
+        for (int row = 0; row < tile_height; row++) {
+            if (row > 0) {
+                sums += row_sums[(row + 2 * WINDOW_SIZE) * tile_width + column]
+                        - row_sums[(row - 1) * tile_width + column];
+            }
+            if (x0 + column < width && y0 + row < height) {
+                stats[(y0 + row) * pitch + x0 + column] = window_statistics(sums);
+            }
+        }
+    }
 }
 
 
+/* Computes the disparity of a row segment of tile_width pixels per work group, with one work item per
+ * disparity of the chunk disp_offset..disp_offset+group_size-1. The group first copies the left windows
+ * of the whole segment, the right strip they are compared against (the segment plus the window and
+ * group_size - 1 columns of disparity halo) and the window statistics into local memory, so each pixel
+ * is read from global memory once per group instead of once per work item. Every item then scores its
+ * disparity for each pixel from local memory, and the best disparity is found with a tree reduction
+ * over the items.
+ * Ranges larger than a work group are covered by one launch per chunk in ascending order. Each chunk
+ * merges its best into best_scores and best_indices, and the last one writes the output image.
+ * Pixels outside the image are clamped to the edge. tile_memory holds
+ * (2 * WINDOW_SIZE + 1) * (2 * tile_width + 4 * WINDOW_SIZE + group_size - 1) + 2 * tile_width + group_size - 1
+ * ints and inv_sigmas holds 2 * tile_width + group_size - 1 floats.
+ */
 __kernel void calculate_zncc(
-        __global uint * left,
-        __global uint * right,
-        __read_only image2d_t left_mean,
-        __read_only image2d_t right_mean,
-        __write_only image2d_t output,
-        uint max_disp,
+        __global PIXEL_T * left,
+        __global PIXEL_T * right,
+        __global float2 * left_stats,
+        __global float2 * right_stats,
+        __global DISP_T * output,
         __local float * znccs,
-        __local float *lower_left_sum,
-        int window_size,
+        __local uint * best_disps,
         int inverse_disp,
         uint width,
-        uint height
+        uint height,
+        uint tile_width,
+        __local int * tile_memory,
+        __local float * inv_sigmas,
+        uint disp_offset,
+        __global float * best_scores,
+        __global uint * best_indices,
+        uint pitch
         ) {
-        sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_LINEAR;
-        uint x = get_global_id(0);
-        uint y = get_global_id(1);
+        int x0 = get_group_id(0) * tile_width;
+        int y = get_global_id(1);
         int local_id = get_local_id(2);
-        int disp = inverse_disp * local_id;
-        int2 coord = {x, y};
-        uint index = y*width+x;
+        int group_size = get_local_size(2);
+        int disp = inverse_disp * (int)(disp_offset + local_id);
+
+        const int window_width = 2 * WINDOW_SIZE + 1;
+        int left_width = tile_width + 2 * WINDOW_SIZE;
+        int right_width = left_width + group_size - 1;
+        // Leftmost right column any item reads, the halo is on the side the disparities shift towards
+        int right_start = x0 - WINDOW_SIZE - inverse_disp * (int) disp_offset - (inverse_disp > 0 ? group_size - 1 : 0);
+
+        __local int * left_tile = tile_memory;
+        __local int * right_strip = left_tile + window_width * left_width;
+        __local int * left_means = right_strip + window_width * right_width;
+        __local int * right_means = left_means + tile_width;
+        __local float * left_inv_sigmas = inv_sigmas;
+        __local float * right_inv_sigmas = inv_sigmas + tile_width;
+
+        for (int i = local_id; i < window_width * left_width; i += group_size) {
+            int row = min((int)(height - 1), max(0, y - WINDOW_SIZE + i / left_width));
+            int column = min((int)(width - 1), max(0, x0 - WINDOW_SIZE + i % left_width));
+            left_tile[i] = left[row * pitch + column];
+        }
+        for (int i = local_id; i < window_width * right_width; i += group_size) {
+            int row = min((int)(height - 1), max(0, y - WINDOW_SIZE + i / right_width));
+            int column = min((int)(width - 1), max(0, right_start + i % right_width));
+            right_strip[i] = right[row * pitch + column];
+        }
+        for (int i = local_id; i < tile_width; i += group_size) {
+            float2 stats = left_stats[y * pitch + min((int)(width - 1), x0 + i)];
+            left_means[i] = (int) stats.s0;
+            left_inv_sigmas[i] = stats.s1;
+        }
+        for (int i = local_id; i < tile_width + group_size - 1; i += group_size) {
+            float2 stats = right_stats[y * pitch + min((int)(width - 1), max(0, right_start + WINDOW_SIZE + i))];
+            right_means[i] = (int) stats.s0;
+            right_inv_sigmas[i] = stats.s1;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
 
-        int l_mean = read_imageui(left_mean, sampler, coord).s0;
-        float best_zncc = 0;
+        for (int p = 0; p < tile_width; p++) {
+            // Left edge of the right window relative to the strip, which is also where the statistics
+            // of its centre pixel are kept in right_means and right_inv_sigmas
+            int r_offset = x0 + p - disp - WINDOW_SIZE - right_start;
+            int r_mean = right_means[r_offset];
+            float upper_sum = 0;
+            #pragma unroll
+            for (int y2 = 0; y2 < window_width; y2++) {
+                #pragma unroll
+                for (int x2 = 0; x2 < window_width; x2++) {
+                    int l_pix_val = left_tile[y2 * left_width + p + x2] - left_means[p];
+                    int r_pix_val = right_strip[y2 * right_width + r_offset + x2] - r_mean;
+                    upper_sum += r_pix_val * l_pix_val;
+                }
+            }
+            float zncc = upper_sum * left_inv_sigmas[p] * right_inv_sigmas[r_offset];
+            // Scores that would not beat the initial maximum of 0 count as 0 at disparity 0
+            znccs[local_id] = zncc > 0 ? zncc : 0;
+            best_disps[local_id] = local_id;
+            barrier(CLK_LOCAL_MEM_FENCE);
 
-        if (disp == 0){
-            for(int y1 = -window_size ; y1 <= window_size; y1++ ) {
-                for (int x1 = -window_size ; x1 <= window_size ; x1++ ){
-                    uint pix_val = left[y*width+x];
-                    *lower_left_sum = *lower_left_sum + pix_val;
+            // Ties go to the smaller disparity, as in a sequential scan with a strict comparison
+            for (int stride = 1; stride < group_size; stride *= 2) {
+                int other = local_id + stride;
+                if (local_id % (2 * stride) == 0 && other < group_size) {
+                    if (znccs[other] > znccs[local_id]) {
+                        znccs[local_id] = znccs[other];
+                        best_disps[local_id] = best_disps[other];
+                    }
                 }
+                barrier(CLK_LOCAL_MEM_FENCE);
             }
+
+            if (local_id == 0 && x0 + p < width) {
+                uint index = y * pitch + x0 + p;
+                float best_zncc = znccs[0];
+                uint best_disp = best_zncc > 0 ? disp_offset + best_disps[0] : 0;
+                // Earlier chunks hold smaller disparities, so they win ties
+                if (disp_offset > 0 && !(best_zncc > best_scores[index])) {
+                    best_zncc = best_scores[index];
+                    best_disp = best_indices[index];
+                }
+                best_scores[index] = best_zncc;
+                best_indices[index] = best_disp;
+
+                if (disp_offset + group_size >= MAX_DISP) {
+                    output[index] = best_disp;
+                }
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
         }
+}
+
+/* Scores left pixel x against right pixel x - d for every row of a band and every d in 0..MAX_DISP-1.
+ * ZNCC(L,R,x,y,d) equals ZNCC(R,L,x-d,y,-d), so the right to left map is read from the same scores
+ * by select_disparities. Pairs whose right pixel falls outside the image score 0.
+ */
+__kernel void zncc_cost_band(
+        __global PIXEL_T * left,
+        __global PIXEL_T * right,
+        __global float2 * left_stats,
+        __global float2 * right_stats,
+        __global float * costs,
+        uint width,
+        uint height,
+        uint band_start,
+        uint pitch
+        ) {
+        int x = get_global_id(0);
+        int row = get_global_id(1);
+        int disp = get_global_id(2);
+        int y = band_start + row;
+        if (x >= width) {
+            return;
+        }
+        __global float * cost = &costs[(row * MAX_DISP + disp) * pitch + x];
+
+        if (x - disp < 0) {
+            *cost = 0;
+            return;
+        }
+
+        float2 l_stats = left_stats[y * pitch + x];
+        float2 r_stats = right_stats[y * pitch + x - disp];
+        int l_mean = (int) l_stats.s0;
+        int r_mean = (int) r_stats.s0;
 
-        float lower_right_sum = 0;
         float upper_sum = 0;
-        for(int y2 = -window_size ; y2 <= window_size; y2++ ) {
-            for (int x2 = -window_size ; x2 <= window_size ; x2++ ){
-                int2 coord2 = {x+x2, y+y2};
-                int l_pix_val = left[min((int)(height - 1), max((int)0, (int)(y + y2))) * width + min((int)(width - 1), max((int)0, (int)(x + x2)))] - l_mean;
-                int2 coord3 = {x+x2-disp, y+y2};
-                uint r_mean = read_imageui(right_mean, sampler, coord3).s0;
-                int r_pix_val = right[min((int)(height -1), max((int)0, (int)(y + y2))) * width + min((int)(width - 1), max((int)0, (int)(x + x2 - disp)))] - r_mean;
-                lower_right_sum += r_pix_val * r_pix_val;
-                upper_sum += r_pix_val * l_pix_val;
+        #pragma unroll
+        for (int y2 = -WINDOW_SIZE ; y2 <= WINDOW_SIZE; y2++) {
+            int row_index = min((int)(height - 1), max((int)0, y + y2)) * pitch;
+            #pragma unroll
+            for (int x2 = -WINDOW_SIZE ; x2 <= WINDOW_SIZE ; x2++) {
+                int l_pix_val = left[row_index + min((int)(width - 1), max((int)0, x + x2))] - l_mean;
+                int r_pix_val = right[row_index + min((int)(width - 1), max((int)0, x + x2 - disp))] - r_mean;
+                upper_sum += l_pix_val * r_pix_val;
             }
         }
+        *cost = upper_sum * l_stats.s1 * r_stats.s1;
+}
 
-        barrier(CLK_LOCAL_MEM_FENCE);
-        float zncc = upper_sum / (sqrt(*lower_left_sum) * sqrt(lower_right_sum));
-        znccs[local_id] = zncc;
-
-        if (disp > 0) {
+/* Picks the best disparity of each pixel of a band in both directions from the scores of zncc_cost_band */
+__kernel void select_disparities(
+        __global float * costs,
+        __global DISP_T * left_output,
+        __global DISP_T * right_output,
+        uint width,
+        uint band_start,
+        uint pitch
+        ) {
+        int x = get_global_id(0);
+        int row = get_global_id(1);
+        if (x >= width) {
             return;
         }
+        __global float * band_row = &costs[row * MAX_DISP * pitch];
 
-        uint best_disp = 0;
-        for(uint i = 0 ; i < max_disp ; i++) {
-             zncc = znccs[i];
-             if (zncc > best_zncc) {
-                best_disp = i;
-                best_zncc = zncc;
+        uint left_disp = 0;
+        float left_best = 0;
+        uint right_disp = 0;
+        float right_best = 0;
+        for (int disp = 0; disp < MAX_DISP; disp++) {
+            float zncc = band_row[disp * pitch + x];
+            if (zncc > left_best) {
+                left_best = zncc;
+                left_disp = disp;
+            }
+            // Right pixel x pairs with left pixel x + disp
+            if (x + disp < width) {
+                zncc = band_row[disp * pitch + x + disp];
+                if (zncc > right_best) {
+                    right_best = zncc;
+                    right_disp = disp;
+                }
             }
         }
 
-        uint4 best_pix = {best_disp, best_disp, best_disp, 255};
-        write_imageui(output, coord, best_pix);
+        left_output[(band_start + row) * pitch + x] = left_disp;
+        right_output[(band_start + row) * pitch + x] = right_disp;
 }
 
+/* Disparity of a pixel scaled to 0..255 if both maps agree on it, 0 otherwise */
+uint checked_disparity(__global DISP_T * left, __global DISP_T * right, uint index) {
+    uint l = left[index];
+    uint r = right[index];
+    return abs(l-r) < CC_THRESHOLD ? l * 255 / MAX_DISP : 0;
+}
+
+/* Stores the cross-checked map, only used when the intermediate steps are saved */
 __kernel void cross_check(
-    __read_only image2d_t left,
-    __read_only image2d_t right,
-    __write_only image2d_t output,
-    uint threshold,
-    uint max_disp
+    __global DISP_T * left,
+    __global DISP_T * right,
+    __global uchar * output,
+    uint width,
+    uint height,
+    uint pitch
     ) {
     int x = get_global_id(0);
     int y = get_global_id(1);
-
-    int2 coord = {x,y};
-
-    sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_NONE | CLK_FILTER_LINEAR;
-    uint l = read_imageui(left, sampler, coord).s0;
-    uint r = read_imageui(right, sampler, coord).s0;
-
-    if(abs(l-r) < threshold){
-        l = l * 255 / max_disp;
-        uint4 pix = {l, l, l, 255};
-        write_imageui(output, coord, pix);
-    } else {
-        uint4 pix = {0, 0, 0, 255};
-        write_imageui(output, coord, pix);
+    if (x >= width || y >= height) {
+        return;
     }
+
+    output[y * pitch + x] = checked_disparity(left, right, y * pitch + x);
 }
 
-/* Finds the nearest nonzero pixel by extending a ring around the current pixel
- *
+/* Cross-checks the disparity maps and fills the pixels that fail the check with the nearest one that
+ * passes, found by extending a ring around the current pixel. The check of each neighbour is evaluated
+ * from the two maps, so the cross-checked map is never written to global memory. The search gives up
+ * after a radius of 100 pixels, so this is only used with RING_FILL.
  */
-__kernel void nearest_nonzero(
-    __read_only image2d_t input,
-    __write_only image2d_t output
+__kernel void cross_check_fill(
+    __global DISP_T * left,
+    __global DISP_T * right,
+    __write_only image2d_t output,
+    uint pitch
     ) {
     int x = get_global_id(0);
     int y = get_global_id(1);
     int2 coord={x, y};
+    int width = get_image_width(output), height = get_image_height(output);
+    if (x >= width || y >= height) {
+        return;
+    }
 
     float closest_dist = -1;
     uint closest_value = 0;
 
-    sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP | CLK_FILTER_LINEAR;
-
     for (int offset = 0; offset < 100; offset++) {
         if (closest_dist >= 0 && closest_dist <= offset) {
             // We can no longer find a closer pixel within the current offset
@@ -161,8 +417,12 @@ __kernel void nearest_nonzero(
                     continue;
                 }
 
-                int2 coord2 = {x+xsign,y + ysign};
-                uint pixel = read_imageui(input, sampler, coord2).s0;
+                int x2 = x + xsign, y2 = y + ysign;
+                // Pixels outside the image count as zero
+                if (x2 < 0 || x2 >= width || y2 < 0 || y2 >= height) {
+                    continue;
+                }
+                uint pixel = checked_disparity(left, right, y2 * pitch + x2);
                 if (pixel > 0) {
                     float dist = sqrt((float)(xsign * xsign + ysign * ysign));
                     if (closest_dist < 0 || closest_dist > dist) {
@@ -174,7 +434,119 @@ __kernel void nearest_nonzero(
         }
     }
 
-    uint4 pix = {closest_value, closest_value, closest_value, 255};
+    uint4 pix = {closest_value, 0, 0, 0};
     write_imageui(output, coord, pix);
 }
 
+
+/* First pass of the exact Euclidean distance transform fill, one work item per column. Stores the row
+ * of the nearest pixel in the same column that passes the cross-check, or -1 if the column has none.
+ * The downward sweep finds the nearest one above, the upward sweep replaces it only if strictly closer.
+ */
+__kernel void edt_columns(
+    __global DISP_T * left,
+    __global DISP_T * right,
+    __global int * feature_rows,
+    uint width,
+    uint height,
+    uint pitch
+    ) {
+    int x = get_global_id(0);
+    if (x >= width) {
+        return;
+    }
+
+    int last = -1;
+    for (int y = 0; y < height; y++) {
+        if (checked_disparity(left, right, y * pitch + x)) {
+            last = y;
+        }
+        feature_rows[y * pitch + x] = last;
+    }
+    last = -1;
+    for (int y = height - 1; y >= 0; y--) {
+        if (checked_disparity(left, right, y * pitch + x)) {
+            last = y;
+        }
+        int row = feature_rows[y * pitch + x];
+        if (last >= 0 && (row < 0 || last - y < y - row)) {
+            feature_rows[y * pitch + x] = last;
+        }
+    }
+}
+
+/* Second pass of the distance transform, one work item per row, following Felzenszwalb and
+ * Huttenlocher, "Distance Transforms of Sampled Functions". The lower envelope of the parabolas
+ * (x - q)^2 + (feature_rows[q] - y)^2 is built in envelope, with the intersections kept as the
+ * fractions z_num / z_den so that ties are broken exactly as in the C++ fill: the leftmost column wins.
+ * Every pixel that fails the cross-check then takes the value of the column the envelope picks for it.
+ * The cost does not depend on the size of the holes, and there is no limit on their radius.
+ */
+__kernel void edt_fill_rows(
+    __global DISP_T * left,
+    __global DISP_T * right,
+    __global int * feature_rows,
+    __global int * envelope,
+    __global long * z_num,
+    __global int * z_den,
+    __write_only image2d_t output,
+    uint width,
+    uint height,
+    uint pitch
+    ) {
+    int y = get_global_id(0);
+    if (y >= height) {
+        return;
+    }
+    __global int * rows = &feature_rows[y * pitch];
+    __global int * v = &envelope[y * pitch];
+    __global long * zn = &z_num[y * pitch];
+    __global int * zd = &z_den[y * pitch];
+
+    int k = -1;
+    for (int q = 0; q < width; q++) {
+        if (rows[q] < 0) {
+            continue;
+        }
+        long fq = (long) (rows[q] - y) * (rows[q] - y) + (long) q * q;
+        if (k < 0) {
+            k = 0;
+            v[0] = q;
+            continue;
+        }
+        long num;
+        int den;
+        for (;;) {
+            int p = v[k];
+            long fp = (long) (rows[p] - y) * (rows[p] - y) + (long) p * p;
+            num = fq - fp;
+            den = 2 * (q - p);
+            // The parabola of v[k] stays the lowest somewhere only if the intersection is right of z[k]
+            if (k == 0 || num * zd[k] > zn[k] * den) {
+                break;
+            }
+            k--;
+        }
+        k++;
+        v[k] = q;
+        zn[k] = num;
+        zd[k] = den;
+    }
+
+    int j = 0;
+    for (int x = 0; x < width; x++) {
+        uint value = checked_disparity(left, right, y * pitch + x);
+        // k stays -1 only if no pixel of the image passes the check
+        if (value == 0 && k >= 0) {
+            // At an exact intersection the parabola found first is kept
+            while (j < k && zn[j + 1] < (long) x * zd[j + 1]) {
+                j++;
+            }
+            int q = v[j];
+            value = checked_disparity(left, right, rows[q] * pitch + q);
+        }
+        int2 coord = {x, y};
+        uint4 pix = {value, 0, 0, 0};
+        write_imageui(output, coord, pix);
+    }
+}